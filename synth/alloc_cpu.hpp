@@ -1,49 +1,488 @@
 #ifndef ALLOC_CPU_H
 #define ALLOC_CPU_H
 
+#include <algorithm>
+#include <cerrno>
 #include <cstdio>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "options.hpp"
+#include "util.hpp"
 
 #if defined(__APPLE__) || defined(__linux__)
 #include <sys/mman.h>
+#include <unistd.h>
 
-// Allocate the specified number of bytes. Using this instead of malloc or
-// new makes it possible to try huge pages and other tweaks.
+#if defined(MAP_HUGETLB) && !defined(MAP_HUGE_2MB)
+#define MAP_HUGE_2MB (21 << 26)
+#define MAP_HUGE_1GB (30 << 26)
+#endif
+
+// Dirty ranges of at least this many bytes are dropped with MADV_DONTNEED
+// instead of being zeroed with memset.
+#define POOL_DROP_BYTES (64 << 20)
+
+// RegionPool doesn't hand out regions more than POOL_MAX_SLACK times as large
+// as needed.
+#define POOL_MAX_SLACK 4
+
+// RegionPool keeps at most 1 / POOL_MAX_IDLE_FRACTION of physical memory
+// idle.
+#define POOL_MAX_IDLE_FRACTION 4
+
+AllocPolicy& current_alloc_policy() {
+    static AllocPolicy policy;
+    return policy;
+}
+
+// Set how memory is allocated from now on. Should be called before any
+// threads start allocating.
+void set_alloc_policy(const AllocPolicy &policy) {
+    current_alloc_policy() = policy;
+}
+
+// Thrown when memory can't be mapped. Command line programs let it end the
+// process, while libsynth reports it as an error of the job that allocated.
+class AllocError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Throw an AllocError for the failed call what, with the reason in errno.
+[[noreturn]] void alloc_failed(const std::string &what) {
+    throw AllocError(what + ": " + std::strerror(errno));
+}
+
+// Write message to the log, unless it was already written.
+void report_alloc(const std::string &message) {
+    static std::mutex mutex;
+    static std::unordered_set<std::string> reported;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (reported.insert(message).second) {
+        std::cerr << "alloc: " << message << std::endl;
+    }
+}
+
+// Memory mapped by map_anonymous.
+struct Mapping {
+    void* ptr;
+
+    // The size of the mapping, rounded up to its page size.
+    size_t size;
+
+    // Whether the mapping uses explicit huge pages, which can't be resized or
+    // partially dropped.
+    bool hugetlb;
+};
+
+// Map at least size bytes of fresh, zeroed memory, with the page size and
+// prefaulting set by the current AllocPolicy. If the requested page size
+// isn't available, smaller ones are tried in turn, and the outcome is
+// reported in the log. Mappings smaller than a huge page always use normal
+// pages. If prefault is false, the mapping isn't prefaulted whatever the
+// policy, for memory that may mostly go unused.
+Mapping map_anonymous(size_t size, bool prefault = true) {
+    const AllocPolicy &policy = current_alloc_policy();
+    prefault = prefault && policy.prefault;
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t huge_2m = 2 << 20;
+    const size_t huge_1g = 1 << 30;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    PageSize page = policy.page_size;
+#ifdef MAP_HUGETLB
+    struct { PageSize page; size_t bytes; int flag; const char* name; } huge_sizes[] = {
+        {PageSize::Huge1G, huge_1g, MAP_HUGE_1GB, "1 GB huge pages"},
+        {PageSize::Huge2M, huge_2m, MAP_HUGE_2MB, "2 MB huge pages"},
+    };
+    for (auto &huge : huge_sizes) {
+        if (page != huge.page) {
+            continue;
+        }
+        PageSize next = huge.page == PageSize::Huge1G ? PageSize::Huge2M : PageSize::Transparent;
+        if (size < huge.bytes) {
+            page = next;
+            continue;
+        }
+        size_t length = CEIL_DIV(size, huge.bytes) * huge.bytes;
+        void* ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                flags | MAP_HUGETLB | huge.flag | (prefault ? MAP_POPULATE : 0),
+                -1, 0);
+        if (ptr != MAP_FAILED) {
+            report_alloc(std::string("using ") + huge.name);
+            return {ptr, length, true};
+        }
+        report_alloc(std::string(huge.name) + " unavailable ("
+                + std::strerror(errno) + "), falling back to smaller pages");
+        page = next;
+    }
+#endif
+    if (page == PageSize::Huge2M) {
+        page = PageSize::Transparent;
+    }
+
+    size_t length = CEIL_DIV(size, page_size) * page_size;
+#ifdef MADV_HUGEPAGE
+    if (page == PageSize::Transparent && length >= huge_2m) {
+        // Transparent huge pages need 2 MB aligned addresses, so map extra
+        // and trim it.
+        length = CEIL_DIV(length, huge_2m) * huge_2m;
+        void* ptr = mmap(nullptr, length + huge_2m, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (ptr == MAP_FAILED) {
+            alloc_failed(__func__);
+        }
+        uintptr_t start = CEIL_DIV((uintptr_t) ptr, huge_2m) * huge_2m;
+        if (start > (uintptr_t) ptr) {
+            munmap(ptr, start - (uintptr_t) ptr);
+        }
+        munmap((void*) (start + length), (uintptr_t) ptr + huge_2m - start);
+        ptr = (void*) start;
+
+        if (madvise(ptr, length, MADV_HUGEPAGE) == 0) {
+            report_alloc("using transparent huge pages");
+        } else {
+            report_alloc(std::string("transparent huge pages unavailable (")
+                    + std::strerror(errno) + "), falling back to normal pages");
+        }
+
+        // MAP_POPULATE would fault in normal pages before the madvise, so
+        // touch every page afterwards instead.
+        if (prefault) {
+            for (size_t offset = 0; offset < length; offset += page_size) {
+                ((volatile uint8_t*) ptr)[offset] = 0;
+            }
+        }
+        return {ptr, length, false};
+    }
+#endif
+
+    void* ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+            flags | (prefault ? MAP_POPULATE : 0), -1, 0);
+    if (ptr == MAP_FAILED) {
+        alloc_failed(__func__);
+    }
+    if (length >= huge_2m) {
+        report_alloc("using normal pages");
+    }
+    return {ptr, length, false};
+}
+
+// A new synthesizer is created for every CEGIS iteration, and each one
+// allocates the same large arrays as the last. Instead of unmapping them and
+// having the next synthesizer fault in fresh zeroed pages, freed regions are
+// kept here and handed out again, warm. Regions that were written to are only
+// zeroed again if the next user needs zeroed memory, and only as far as they
+// were written to.
+class RegionPool {
+private:
+    struct Region {
+        void* ptr;
+        size_t capacity;
+
+        // Only the first dirty bytes may be nonzero.
+        size_t dirty;
+
+        // See Mapping::hugetlb.
+        bool hugetlb;
+    };
+
+    std::mutex mutex;
+
+    // Regions not in use, oldest first, and their total capacity.
+    std::vector<Region> idle;
+    size_t idle_bytes = 0;
+
+    // Regions in use, by address.
+    std::unordered_map<void*, Region> used;
+
+    const size_t page_size;
+
+    // At most this many bytes are kept idle; older regions are unmapped.
+    const size_t max_idle_bytes;
+
+    size_t round_to_pages(size_t size) const {
+        return CEIL_DIV(size, page_size) * page_size;
+    }
+
+    // Zero the first size bytes of region. Large ranges are dropped instead,
+    // so that the kernel zeroes pages lazily as they are touched again.
+    void zero(Region &region, size_t size) {
+        size_t length = std::min(region.dirty, size);
+        if (length >= POOL_DROP_BYTES && !region.hugetlb) {
+            madvise(region.ptr, round_to_pages(length), MADV_DONTNEED);
+        } else {
+            memset(region.ptr, 0, length);
+        }
+        if (region.dirty <= size) {
+            region.dirty = 0;
+        }
+    }
+
+public:
+    RegionPool() :
+        page_size(sysconf(_SC_PAGESIZE)),
+        max_idle_bytes(sysconf(_SC_PHYS_PAGES) * page_size / POOL_MAX_IDLE_FRACTION) {}
+
+    ~RegionPool() {
+        for (Region &region : idle) {
+            munmap(region.ptr, region.capacity);
+        }
+    }
+
+    static RegionPool& global() {
+        static RegionPool pool;
+        return pool;
+    }
+
+    // Return a region of at least size bytes, zeroed if zeroed is true. New
+    // regions are prefaulted if prefault is true (see map_anonymous).
+    void* take(size_t size, bool zeroed, bool prefault = true) {
+        Region region = {nullptr, 0, 0, false};
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            // Prefer the smallest region that fits, unless it is much too
+            // big. Otherwise, grow the largest one, which keeps its pages.
+            ssize_t best = -1;
+            for (size_t i = 0; i < idle.size(); i++) {
+                if (idle[i].capacity > round_to_pages(size) * POOL_MAX_SLACK) {
+                    continue;
+                }
+                if (idle[i].capacity >= size && (best == -1
+                            || idle[best].capacity < size
+                            || idle[i].capacity < idle[best].capacity)) {
+                    best = i;
+                } else if (idle[i].capacity < size && (best == -1
+                            || (idle[best].capacity < size
+                                && idle[i].capacity > idle[best].capacity))) {
+                    best = i;
+                }
+            }
+            if (best != -1) {
+                region = idle[best];
+                idle.erase(idle.begin() + best);
+                idle_bytes -= region.capacity;
+            }
+        }
+
+        if (region.ptr != nullptr && region.capacity < size) {
+#ifdef MREMAP_MAYMOVE
+            // Explicit huge pages can't be resized.
+            void* ptr = region.hugetlb ? MAP_FAILED
+                : mremap(region.ptr, region.capacity, round_to_pages(size), MREMAP_MAYMOVE);
+            if (ptr != MAP_FAILED) {
+                region.ptr = ptr;
+                region.capacity = round_to_pages(size);
+            }
+#endif
+            if (region.capacity < size) {
+                munmap(region.ptr, region.capacity);
+                region.ptr = nullptr;
+            }
+        }
+
+        if (region.ptr == nullptr) {
+            Mapping mapping = map_anonymous(size, prefault);
+            region = {mapping.ptr, mapping.size, 0, mapping.hugetlb};
+        } else if (zeroed) {
+            zero(region, size);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        used[region.ptr] = region;
+        return region.ptr;
+    }
+
+    // Return a region from take, of which size bytes were used. If zeroed is
+    // true, the caller guarantees that those bytes are zero again. Returns
+    // false if ptr didn't come from take.
+    bool give(void* ptr, size_t size, bool zeroed) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = used.find(ptr);
+        if (it == used.end()) {
+            return false;
+        }
+        Region region = it->second;
+        used.erase(it);
+
+        if (!zeroed) {
+            region.dirty = std::max(region.dirty, size);
+        } else if (region.dirty <= size) {
+            region.dirty = 0;
+        }
+
+        idle.push_back(region);
+        idle_bytes += region.capacity;
+        while (idle_bytes > max_idle_bytes) {
+            munmap(idle.front().ptr, idle.front().capacity);
+            idle_bytes -= idle.front().capacity;
+            idle.erase(idle.begin());
+        }
+        return true;
+    }
+};
+
+// Allocate the specified number of bytes, zeroed. Using this instead of malloc
+// or new makes it possible to try huge pages and other tweaks, and to reuse
+// memory between synthesizers (see RegionPool).
 void* alloc(size_t size) {
-    void* ptr = mmap(
-        nullptr,
-        size,
-        PROT_READ | PROT_WRITE,
-        MAP_PRIVATE | MAP_ANONYMOUS,
-        -1,
-        0
-    );
+    return RegionPool::global().take(size, true);
+}
+
+// Like alloc, but the memory may hold data from an earlier allocation, and
+// isn't prefaulted if prefault is false.
+void* alloc_uninitialized(size_t size, bool prefault = true) {
+    return RegionPool::global().take(size, false, prefault);
+}
 
+// Allocate the specified number of zeroed bytes, which stay shared with any
+// processes forked afterwards, instead of being copied on write. Pages are only
+// reserved as they are touched.
+void* alloc_shared(size_t size) {
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
     if (ptr == MAP_FAILED) {
-        std::perror(__func__);
-        std::exit(1);
+        alloc_failed(__func__);
+    }
+    return ptr;
+}
+
+// Allocate the specified number of bytes, backed by a file in spill_dir
+// instead of anonymous memory, so that the kernel can write pages back to the
+// file when memory is short instead of running out. The file is unlinked
+// immediately, and disappears when the memory is deallocated. Either way, the
+// memory is shared with processes forked afterwards. If spill_dir is empty,
+// this is the same as alloc_shared if shared is true, and alloc_uninitialized
+// otherwise, which is passed prefault.
+void* alloc_spilled(size_t size, const std::string &spill_dir, bool shared = false,
+        bool prefault = true) {
+    if (spill_dir.empty()) {
+        return shared ? alloc_shared(size) : alloc_uninitialized(size, prefault);
+    }
+
+    std::string path = spill_dir + "/synth-spill-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd == -1) {
+        alloc_failed(path);
+    }
+    unlink(path.c_str());
+
+    // The file is sparse, so only the pages that are written take up space.
+    void* ptr = ftruncate(fd, size) != 0 ? MAP_FAILED
+        : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        alloc_failed(__func__);
     }
+    close(fd);
 
     return ptr;
 }
 
+// Memory that can't be unmapped is leaked, since this is called by
+// destructors, which can't fail.
 void dealloc(void* ptr, size_t size) {
-    if (munmap(ptr, size)) {
+    // Memory from alloc_spilled isn't pooled.
+    if (!RegionPool::global().give(ptr, size, false) && munmap(ptr, size)) {
         std::perror(__func__);
-        std::exit(1);
     }
 }
+
+// Like dealloc, for memory whose first size bytes the caller has set back to
+// zero, which saves zeroing it again when it is reused.
+void dealloc_zeroed(void* ptr, size_t size) {
+    if (!RegionPool::global().give(ptr, size, true) && munmap(ptr, size)) {
+        std::perror(__func__);
+    }
+}
+
+// Hints about how memory will be accessed, for memory from alloc_spilled.
+enum class Access {
+    // Read in order, and not again soon.
+    Sequential,
+    // Read soon; start reading it in.
+    WillNeed,
+    // Not needed for a while; write it back first when memory is short.
+    Cold,
+};
+
+// Pass an access hint to the kernel. This is best effort, so errors are
+// ignored.
+void advise(const void* ptr, size_t size, Access access) {
+    if (size == 0) {
+        return;
+    }
+
+    // madvise needs a page-aligned address.
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t) ptr & ~(page_size - 1);
+    size_t length = (uintptr_t) ptr + size - start;
+
+    int advice = MADV_NORMAL;
+    switch (access) {
+        case Access::Sequential:
+            advice = MADV_SEQUENTIAL;
+            break;
+        case Access::WillNeed:
+            advice = MADV_WILLNEED;
+            break;
+        case Access::Cold:
+#ifdef MADV_COLD
+            advice = MADV_COLD;
+#endif
+            break;
+    }
+    madvise((void*) start, length, advice);
+}
 #else
+void set_alloc_policy(const AllocPolicy &policy) {}
+
 // Allocate the specified number of bytes. Using this instead of malloc or
 // new makes it possible to try huge pages and other tweaks.
 void* alloc(size_t size) {
     return calloc(1,size);
 }
 
+void* alloc_uninitialized(size_t size, bool prefault = true) {
+    return alloc(size);
+}
+
+void* alloc_shared(size_t size) {
+    return alloc(size);
+}
+
+void* alloc_spilled(size_t size, const std::string &spill_dir, bool shared = false,
+        bool prefault = true) {
+    return alloc(size);
+}
+
 void dealloc(void* ptr, size_t size) {
     free(ptr);
 }
 
+void dealloc_zeroed(void* ptr, size_t size) {
+    free(ptr);
+}
+
+enum class Access {
+    Sequential,
+    WillNeed,
+    Cold,
+};
+
+void advise(const void* ptr, size_t size, Access access) {}
+
 #endif
 
 #endif
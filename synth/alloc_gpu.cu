@@ -1,7 +1,13 @@
 #ifndef ALLOC_GPU_H
 #define ALLOC_GPU_H
 
+#include <string>
+
 #include "gpu_assert.cu"
+#include "options.hpp"
+
+// Managed memory is allocated by the CUDA runtime, so the policy is ignored.
+void set_alloc_policy(const AllocPolicy &policy) {}
 
 void* alloc(size_t size) {
     void* ptr;
@@ -9,8 +15,35 @@ void* alloc(size_t size) {
     return ptr;
 }
 
+void* alloc_uninitialized(size_t size, bool prefault = true) {
+    return alloc(size);
+}
+
 void dealloc(void* ptr, size_t size) {
     gpuAssert(cudaFree(ptr));
 }
 
+void dealloc_zeroed(void* ptr, size_t size) {
+    dealloc(ptr, size);
+}
+
+// Managed memory can't be backed by a file or shared with other processes,
+// so spilling and sharding aren't supported.
+void* alloc_shared(size_t size) {
+    return alloc(size);
+}
+
+void* alloc_spilled(size_t size, const std::string &spill_dir, bool shared = false,
+        bool prefault = true) {
+    return alloc(size);
+}
+
+enum class Access {
+    Sequential,
+    WillNeed,
+    Cold,
+};
+
+void advise(const void* ptr, size_t size, Access access) {}
+
 #endif
@@ -0,0 +1,374 @@
+// On-disk format for checkpointing a bank between passes.
+//
+// A bank file is a log, which every checkpoint appends the passes completed
+// since the last one to. It contains, in order:
+//
+// 1. A BankFileHeader.
+// 2. The variable values and heights that the bank was built from.
+// 3. For every completed pass, a BankFilePass, followed by the results of the
+//    terms it added and their left and right operands (see TermOperands).
+//
+// Every section starts on a BANK_FILE_ALIGNMENT boundary. The seen bitset
+// isn't stored, since it is rebuilt from the results in a single pass, and
+// would otherwise have to be rewritten in full at every checkpoint.
+//
+// The bank only depends on the variables and the examples, which determine
+// the file name, so a bank built for one target can be reused for another
+// (see AbstractSynthesizer::load_bank). Since the examples change with every
+// CEGIS iteration, the directory is kept under a size limit by removing the
+// least recently used files (see evict_lru).
+
+#ifndef BANK_FILE_H
+#define BANK_FILE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "operands.hpp"
+#include "util.hpp"
+
+#define BANK_FILE_MAGIC "SYNTHBNK"
+#define BANK_FILE_VERSION 2
+#define BANK_FILE_ALIGNMENT 8
+
+struct BankFileHeader {
+    char magic[8];
+    uint32_t version;
+
+    // sizeof(Result) of the synthesizer that wrote the file.
+    uint32_t result_size;
+
+    uint32_t num_examples;
+    uint32_t num_vars;
+};
+
+struct BankFilePass {
+    int64_t start;
+    int64_t end;
+    int32_t height;
+    int32_t type;
+    TermOperands::Layout layout;
+
+    // The target of the run that added the pass. Checkpoints are only taken
+    // when no solution was found, so the bank doesn't depend on it, but the
+    // passes that were run do (see load_bank).
+    uint32_t sol_result;
+    int32_t sol_height;
+};
+
+// Return the name of the bank file for the given variables and examples. Only
+// the first num_vars variable values are used, since Spec may have more.
+std::string bank_file_name(uint32_t num_examples, uint32_t result_size,
+        uint32_t num_vars, const std::vector<uint32_t> &var_values,
+        const std::vector<int32_t> &var_heights) {
+    // 64-bit FNV-1a. The header is checked on load, so collisions are only a
+    // missed opportunity.
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    auto mix = [&](uint32_t value) {
+        for (int32_t i = 0; i < 4; i++) {
+            hash ^= (value >> (8 * i)) & 0xff;
+            hash *= 0x100000001b3ULL;
+        }
+    };
+    mix(num_examples);
+    mix(result_size);
+    for (uint32_t i = 0; i < num_vars; i++) {
+        mix(var_values[i]);
+        mix(var_heights[i]);
+    }
+
+    std::ostringstream name;
+    name << "bank-" << std::hex << hash << ".bin";
+    return name.str();
+}
+
+// Remove the least recently modified files in dir whose names start with
+// prefix and end with extension, until they fit in max_bytes. The file at
+// keep, which is in use by the caller, is never removed. Other processes may
+// be adding or removing files at the same time, so files that disappear are
+// skipped.
+void evict_lru(const std::string &dir, const std::string &prefix,
+        const std::string &extension, uint64_t max_bytes, const std::string &keep = "") {
+    struct Entry {
+        std::filesystem::path path;
+        std::filesystem::file_time_type time;
+        uint64_t size;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t total_bytes = 0;
+    std::error_code error;
+    for (auto it = std::filesystem::directory_iterator(dir, error);
+            !error && it != std::filesystem::directory_iterator();
+            it.increment(error)) {
+        std::string name = it->path().filename().string();
+        if (name.rfind(prefix, 0) != 0 || it->path().extension() != extension) {
+            continue;
+        }
+        std::error_code entry_error;
+        uint64_t size = it->file_size(entry_error);
+        auto time = it->last_write_time(entry_error);
+        if (entry_error) {
+            continue;
+        }
+        entries.push_back({it->path(), time, size});
+        total_bytes += size;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.time < b.time;
+    });
+    for (const Entry &entry : entries) {
+        if (total_bytes <= max_bytes) {
+            break;
+        }
+        if (entry.path == std::filesystem::path(keep)) {
+            continue;
+        }
+        std::error_code remove_error;
+        std::filesystem::remove(entry.path, remove_error);
+        total_bytes -= entry.size;
+    }
+}
+
+// Writes a bank file to a temporary file, which replaces the destination
+// atomically on commit, so that a crash never leaves a partial file behind.
+class BankFileWriter {
+private:
+    std::string path;
+    std::string tmp_path;
+    FILE* file;
+    size_t offset;
+    bool failed;
+
+public:
+    BankFileWriter(const std::string &path) :
+            path(path),
+            offset(0),
+            failed(false) {
+        // Unique per process and writer, since the same bank can be
+        // checkpointed concurrently.
+        static int32_t counter = 0;
+        std::ostringstream tmp;
+        tmp << path << ".tmp." << getpid() << "."
+            << __atomic_fetch_add(&counter, 1, __ATOMIC_SEQ_CST);
+        tmp_path = tmp.str();
+
+        file = fopen(tmp_path.c_str(), "wb");
+        if (file == nullptr) {
+            std::perror(tmp_path.c_str());
+            failed = true;
+        }
+    }
+
+    ~BankFileWriter() {
+        if (file != nullptr) {
+            fclose(file);
+            unlink(tmp_path.c_str());
+        }
+    }
+
+    void write(const void* data, size_t size) {
+        if (failed || size == 0) {
+            return;
+        }
+        if (fwrite(data, 1, size, file) != size) {
+            std::perror(tmp_path.c_str());
+            failed = true;
+        }
+        offset += size;
+    }
+
+    // Pad the file up to the next section boundary.
+    void align() {
+        static const uint8_t zeros[BANK_FILE_ALIGNMENT] = {};
+        write(zeros, CEIL_DIV(offset, BANK_FILE_ALIGNMENT) * BANK_FILE_ALIGNMENT - offset);
+    }
+
+    // Make the file durable and move it into place. Returns false if any
+    // write failed, in which case the previous file is left untouched.
+    bool commit() {
+        if (file == nullptr) {
+            return false;
+        }
+        if (!failed && (fflush(file) != 0 || fsync(fileno(file)) != 0)) {
+            std::perror(tmp_path.c_str());
+            failed = true;
+        }
+        if (fclose(file) != 0 && !failed) {
+            std::perror(tmp_path.c_str());
+            failed = true;
+        }
+        file = nullptr;
+
+        if (!failed && rename(tmp_path.c_str(), path.c_str()) != 0) {
+            std::perror(path.c_str());
+            failed = true;
+        }
+        if (failed) {
+            unlink(tmp_path.c_str());
+        }
+        return !failed;
+    }
+};
+
+// Appends to a bank file, under an exclusive lock that is held until the
+// appender is destroyed, so that concurrent runs with the same bank never
+// interleave their writes, and readers never see the file truncated.
+class BankFileAppender {
+private:
+    std::string path;
+    int fd;
+    size_t offset;
+    bool failed;
+
+public:
+    BankFileAppender(const std::string &path) :
+            path(path),
+            offset(0),
+            failed(false) {
+        fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd == -1 || flock(fd, LOCK_EX) != 0) {
+            std::perror(path.c_str());
+            failed = true;
+        }
+    }
+
+    ~BankFileAppender() {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+
+    // The current size of the file, or SIZE_MAX if it can't be determined.
+    size_t size() {
+        struct stat info;
+        if (failed || fstat(fd, &info) != 0) {
+            return SIZE_MAX;
+        }
+        return info.st_size;
+    }
+
+    // Discard everything after the first size bytes of the file, and continue
+    // writing from there.
+    void truncate(size_t size) {
+        if (!failed && (ftruncate(fd, size) != 0 || lseek(fd, size, SEEK_SET) == -1)) {
+            std::perror(path.c_str());
+            failed = true;
+        }
+        offset = size;
+    }
+
+    void write(const void* data, size_t size) {
+        if (failed || size == 0) {
+            return;
+        }
+        if (::write(fd, data, size) != (ssize_t) size) {
+            std::perror(path.c_str());
+            failed = true;
+        }
+        offset += size;
+    }
+
+    // Pad the file up to the next section boundary.
+    void align() {
+        static const uint8_t zeros[BANK_FILE_ALIGNMENT] = {};
+        write(zeros, CEIL_DIV(offset, BANK_FILE_ALIGNMENT) * BANK_FILE_ALIGNMENT - offset);
+    }
+
+    // The size of the file once everything written so far is committed.
+    size_t end() const {
+        return offset;
+    }
+
+    // Make the appended data durable. Returns false if any write failed, in
+    // which case a later reader ignores the incomplete pass at the end.
+    bool commit() {
+        if (!failed && fdatasync(fd) != 0) {
+            std::perror(path.c_str());
+            failed = true;
+        }
+        return !failed;
+    }
+};
+
+// Reads a bank file by mapping it into memory, under a shared lock, so that
+// it isn't truncated while it is being read.
+class BankFileReader {
+private:
+    const uint8_t* data;
+    size_t size;
+    size_t offset;
+    int fd;
+
+public:
+    BankFileReader(const std::string &path) : data(nullptr), size(0), offset(0) {
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            // Usually, there is no bank for these examples yet.
+            return;
+        }
+
+        struct stat info;
+        if (flock(fd, LOCK_SH) == 0 && fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* ptr = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr != MAP_FAILED) {
+                data = (const uint8_t*) ptr;
+                size = info.st_size;
+            }
+        }
+    }
+
+    ~BankFileReader() {
+        if (data != nullptr) {
+            munmap((void*) data, size);
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+
+    bool is_open() const {
+        return data != nullptr;
+    }
+
+    // The size of the file, and the offset of the next read.
+    size_t file_size() const {
+        return size;
+    }
+
+    size_t position() const {
+        return offset;
+    }
+
+    // Return a pointer to the next size bytes of the file, or nullptr if the
+    // file is too short.
+    const void* read(size_t length) {
+        if (data == nullptr || length > size - offset) {
+            return nullptr;
+        }
+        const void* ptr = &data[offset];
+        offset += length;
+        return ptr;
+    }
+
+    // Skip to the next section boundary.
+    void align() {
+        offset = std::min(size, CEIL_DIV(offset, BANK_FILE_ALIGNMENT) * BANK_FILE_ALIGNMENT);
+    }
+};
+
+#endif
@@ -0,0 +1,333 @@
+// Solving a whole directory of specs on one shared pool of worker threads.
+//
+// Most specs are solved in milliseconds by a single thread, while a few need
+// every core for minutes. Solving them one at a time leaves most cores idle
+// during the small ones, so instead, small specs run side by side with one
+// thread each, and large specs wait for the whole pool and get every thread.
+// Specs are parsed by a separate thread while earlier ones are being solved,
+// and results are written to a results file as soon as each spec finishes.
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "budget.hpp"
+#include "closure.hpp"
+#include "expr.hpp"
+#include "spec.hpp"
+#include "timer.hpp"
+
+// Specs with a score (see batch_threads) of at least this much get the whole
+// pool.
+#define BATCH_LARGE_SCORE 12
+
+// Number of parsed specs that may be waiting for a worker, per worker.
+#define BATCH_QUEUE_PER_WORKER 2
+
+struct BatchOptions {
+    // Number of worker threads, or 0 for one per core.
+    int32_t jobs = 0;
+
+    // Where results are written, one JSON object per line.
+    std::string results_path = "batch_results.jsonl";
+
+    // If arg is a recognized option of the form --key=value, apply it and
+    // return true.
+    bool parse(const std::string &arg) {
+        std::string key = arg.substr(0, arg.find('='));
+        if (arg.find('=') == std::string::npos) {
+            return false;
+        }
+        std::string value = arg.substr(key.size() + 1);
+
+        try {
+            if (key == "--jobs") {
+                jobs = std::stoi(value);
+            } else if (key == "--results") {
+                results_path = value;
+            } else {
+                return false;
+            }
+        } catch (const std::logic_error&) {
+            return false;
+        }
+        return true;
+    }
+};
+
+// The outcome of solving one spec.
+struct BatchResult {
+    // Whether a solution was found.
+    bool solved;
+
+    int32_t iterations;
+
+    // The solution, as printed by Expr::print, and a human readable report,
+    // which is appended to the log.
+    std::string solution;
+    std::string report;
+
+    // The budget that stopped synthesis, if it wasn't solved.
+    BudgetStatus budget = {};
+};
+
+// The status of a result in the results file and in server responses.
+const char* batch_status(const BatchResult &result) {
+    if (result.solved) {
+        return "solved";
+    }
+    return result.budget.exceeded() ? "budget_exceeded" : "no_solution";
+}
+
+// Write the fields describing the exceeded budget of result, if any, to a
+// JSON object.
+void write_budget_fields(std::ostream &out, const BatchResult &result) {
+    if (result.budget.exceeded()) {
+        out << ", \"budget\": \"" << budget_limit_name(result.budget.limit) << "\""
+            << ", \"height\": " << result.budget.height
+            << ", \"num_terms\": " << result.budget.num_terms;
+    }
+}
+
+// Return the number of threads to give spec, out of num_workers. The cost of
+// a spec grows exponentially with both its number of variables and its
+// height, so their sum is a rough measure of its size. Specs small enough for
+// the closure synthesizer never need more than one thread.
+int32_t batch_threads(const Spec &spec, int32_t num_workers) {
+    if (spec.all_inputs.size() <= CLOSURE_MAX_EXAMPLES) {
+        return 1;
+    }
+    int32_t score = spec.num_vars + spec.sol_height;
+    return score >= BATCH_LARGE_SCORE ? num_workers : 1;
+}
+
+// Return value as a JSON string literal.
+std::string json_string(const std::string &value) {
+    std::ostringstream out;
+    out << '"';
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if ((unsigned char) c < 0x20) {
+            out << "\\u00" << "0123456789abcdef"[c >> 4] << "0123456789abcdef"[c & 0xf];
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+    return out.str();
+}
+
+// The threads of a pool, shared by specs that are solved concurrently. A spec
+// that needs more than one thread waits until that many are free, and while it
+// waits, specs that need one thread can't take any, so it isn't starved.
+class ThreadBudget {
+private:
+    std::mutex mutex;
+    std::condition_variable changed;
+    int32_t free_threads;
+    bool draining = false;
+
+public:
+    ThreadBudget(int32_t threads) : free_threads(threads) {}
+
+    // Wait until the given number of threads are free, and take them.
+    void acquire(int32_t threads) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (threads > 1) {
+            changed.wait(lock, [&]() { return !draining; });
+            draining = true;
+            changed.wait(lock, [&]() { return free_threads >= threads; });
+            draining = false;
+        } else {
+            changed.wait(lock, [&]() { return !draining && free_threads >= threads; });
+        }
+        free_threads -= threads;
+    }
+
+    void release(int32_t threads) {
+        std::lock_guard<std::mutex> lock(mutex);
+        free_threads += threads;
+        changed.notify_all();
+    }
+};
+
+class BatchRunner {
+public:
+    // Solves one spec, on the calling thread.
+    typedef std::function<BatchResult(Spec&)> Solver;
+
+private:
+    struct Job {
+        size_t index;
+        std::string path;
+        std::unique_ptr<Spec> spec;
+    };
+
+    const int32_t num_workers;
+    Solver solver;
+
+    std::mutex mutex;
+
+    // Parsed specs waiting for a worker, and whether the parser is done.
+    std::condition_variable queue_changed;
+    std::deque<Job> queue;
+    bool parsed_all = false;
+
+    ThreadBudget budget;
+
+    std::ofstream results;
+    std::ostream &log;
+
+    void parse_all(const std::vector<std::string> &paths,
+            std::function<Spec(const std::string&)> parse) {
+        for (size_t i = 0; i < paths.size(); i++) {
+            // A spec that can't be parsed is reported, and the rest go on.
+            Job job = {i, paths[i], nullptr};
+            try {
+                job.spec = std::make_unique<Spec>(parse(paths[i]));
+            } catch (const std::exception &e) {
+                write_error(job, std::string("can't parse spec: ") + e.what());
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            queue_changed.wait(lock, [&]() {
+                return queue.size() < (size_t) num_workers * BATCH_QUEUE_PER_WORKER;
+            });
+            queue.push_back(std::move(job));
+            queue_changed.notify_all();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        parsed_all = true;
+        queue_changed.notify_all();
+    }
+
+    void write_result(const Job &job, const BatchResult &result,
+            int32_t threads, uint64_t ms) {
+        std::lock_guard<std::mutex> lock(mutex);
+        results << "{\"index\": " << job.index
+            << ", \"path\": " << json_string(job.path)
+            << ", \"num_vars\": " << job.spec->num_vars
+            << ", \"sol_height\": " << job.spec->sol_height
+            << ", \"status\": \"" << batch_status(result) << "\""
+            << ", \"iterations\": " << result.iterations
+            << ", \"threads\": " << threads
+            << ", \"ms\": " << ms;
+        if (result.solved) {
+            results << ", \"solution\": " << json_string(result.solution);
+        }
+        write_budget_fields(results, result);
+        results << "}" << std::endl;
+
+        log << job.path << std::endl << result.report;
+    }
+
+    void write_error(const Job &job, const std::string &error) {
+        std::lock_guard<std::mutex> lock(mutex);
+        results << "{\"index\": " << job.index
+            << ", \"path\": " << json_string(job.path)
+            << ", \"status\": \"error\""
+            << ", \"message\": " << json_string(error) << "}" << std::endl;
+
+        log << job.path << std::endl << error << std::endl << std::endl;
+    }
+
+    void work() {
+        while (true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                queue_changed.wait(lock, [&]() { return !queue.empty() || parsed_all; });
+                if (queue.empty()) {
+                    return;
+                }
+                job = std::move(queue.front());
+                queue.pop_front();
+                queue_changed.notify_all();
+            }
+
+            int32_t threads = batch_threads(*job.spec, num_workers);
+            budget.acquire(threads);
+#ifdef _OPENMP
+            omp_set_num_threads(threads);
+#endif
+
+            // Expressions for this spec are freed once it is written out.
+            ExprArena arena;
+            ExprArena::Scope scope(arena);
+            Timer timer;
+            BatchResult result;
+            try {
+                result = solver(*job.spec);
+            } catch (const std::exception &e) {
+                // A spec that fails, say because its bank can't be
+                // allocated, is reported, and the rest are still solved.
+                budget.release(threads);
+                write_error(job, e.what());
+                continue;
+            }
+            uint64_t ms = timer.ms();
+
+            budget.release(threads);
+            write_result(job, result, threads, ms);
+        }
+    }
+
+public:
+    // Results are written to results_path, and reports to log. jobs is the
+    // number of worker threads, or 0 for one per core.
+    BatchRunner(int32_t jobs, Solver solver, const std::string &results_path,
+            std::ostream &log) :
+        num_workers(jobs > 0 ? jobs : std::max(1U, std::thread::hardware_concurrency())),
+        solver(solver),
+        budget(num_workers),
+        results(results_path),
+        log(log) {
+        if (!results) {
+            std::perror(results_path.c_str());
+            std::exit(1);
+        }
+    }
+
+    // Parse and solve every spec, and return once all of them are done.
+    void run(const std::vector<std::string> &paths,
+            std::function<Spec(const std::string&)> parse) {
+        std::cerr << "Solving " << paths.size() << " spec(s) with "
+            << num_workers << " worker(s)" << std::endl;
+
+        std::thread parser([&]() { parse_all(paths, parse); });
+        std::vector<std::thread> workers;
+        for (int32_t i = 0; i < num_workers; i++) {
+            workers.emplace_back([this]() { work(); });
+        }
+
+        parser.join();
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,188 @@
+// Benchmark the synthesizer variant of your choice end to end, on a fixed
+// list of specs (bench_specs.txt), and optionally compare against a baseline.
+//
+// Each spec is solved --repeats times, with its examples drawn with --seed so
+// that every run does the same work. Runs are done in a child process each,
+// so that peak resident memory is measured per run and one spec's allocations
+// don't carry over to the next.
+//
+// For example, to compare a change against master:
+//     ./bench_cpu_mt --tier=medium --results=base.csv      (on master)
+//     ./bench_cpu_mt --tier=medium --compare=base.csv      (with the change)
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.hpp"
+#include "cegis.hpp"
+#include "expr.hpp"
+#include "options.hpp"
+#include "parser.hpp"
+#include "spec.hpp"
+#include "timer.hpp"
+
+#ifndef SYNTH_VARIANT
+#error "SYNTH_VARIANT must be defined. See the Makefile."
+#elif SYNTH_VARIANT == 1
+#include "synth_cpu_st.hpp"
+#define VARIANT_DESCRIPTION "CPU, single threaded"
+#define VARIANT_NAME "cpu_st"
+#elif SYNTH_VARIANT == 2
+#include "synth_cpu_mt.hpp"
+#define VARIANT_DESCRIPTION "CPU, multi-threaded"
+#define VARIANT_NAME "cpu_mt"
+#else
+#error "Unsupported SYNTH_VARIANT."
+#endif
+
+// The outcome of one run, sent from the child to the parent.
+struct BenchRun {
+    // 0 if solved, 1 if there is no solution, 2 if a budget was exceeded, and
+    // 3 if the spec has too many variables to synthesize.
+    int32_t status;
+    int32_t iterations;
+    int64_t bank_terms;
+    uint64_t us;
+};
+
+// Solve the spec at path, and return the outcome. The time includes CEGIS
+// and the checks of candidates against the full truth table, but not parsing.
+BenchRun run_spec(const std::string &path, uint64_t seed, Options options) {
+    Spec::example_seed() = seed;
+    Spec spec = Parser::parseInput(path);
+    if (spec.num_vars > 8) {
+        return {3, 0, 0, 0};
+    }
+
+    ExprArena arena;
+    ExprArena::Scope scope(arena);
+
+    Timer timer;
+    Cegis<Synthesizer> run(spec, nullptr, options);
+    while (!run.step(INT64_MAX)) {}
+
+    BenchRun result;
+    result.status = run.solution() != nullptr ? 0 : run.budget_status().exceeded() ? 2 : 1;
+    result.iterations = run.num_iterations();
+    result.bank_terms = run.largest_bank();
+    result.us = timer.ns() / 1000;
+    return result;
+}
+
+// Run run_spec in a child process, and return whether it completed, along
+// with its peak resident memory in KB.
+bool run_child(const std::string &path, uint64_t seed, const Options &options,
+        BenchRun &result, uint64_t &peak_rss_kb) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        std::perror("pipe");
+        std::exit(1);
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::perror("fork");
+        std::exit(1);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        BenchRun run = run_spec(path, seed, options);
+        bool written = write(fds[1], &run, sizeof(run)) == sizeof(run);
+        _exit(written ? 0 : 1);
+    }
+
+    close(fds[1]);
+    bool completed = read(fds[0], &result, sizeof(result)) == sizeof(result);
+    close(fds[0]);
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid) {
+        std::perror("wait4");
+        std::exit(1);
+    }
+    peak_rss_kb = usage.ru_maxrss;
+    return completed && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    std::cerr << "Synthesizer variant: " << VARIANT_DESCRIPTION << std::endl;
+
+    // Arguments are BenchOptions (see bench.hpp), such as --tier=NAME,
+    // --repeats=N or --compare=FILE, or Options for the synthesizer.
+    Options options;
+    BenchOptions bench_options;
+    for (int arg = 1; arg < argc; arg++) {
+        if (!bench_options.parse(argv[arg]) && !options.parse(argv[arg])) {
+            std::cerr << "Unknown argument: " << argv[arg] << std::endl;
+            return 1;
+        }
+    }
+    set_alloc_policy(options.alloc_policy);
+
+    // The log of every pass would swamp the results.
+    std::ostream quiet(nullptr);
+    options.log = &quiet;
+
+    std::vector<BenchCase> cases = read_bench_cases(bench_options.specs_path, bench_options.tier);
+    if (cases.empty()) {
+        std::cerr << "No specs in tier " << bench_options.tier << std::endl;
+        return 1;
+    }
+
+    const char* statuses[] = {"solved", "no_solution", "budget_exceeded", "skipped"};
+    std::vector<BenchRecord> records;
+    for (const BenchCase &bench_case : cases) {
+        BenchRecord record = {VARIANT_NAME, bench_case.tier, bench_case.path, "",
+            bench_options.repeats, 0, 0, 0, 0, 0};
+
+        std::vector<uint64_t> times;
+        for (int32_t i = 0; i < bench_options.repeats; i++) {
+            BenchRun run;
+            uint64_t peak_rss_kb;
+            if (!run_child(bench_case.path, bench_options.seed, options, run, peak_rss_kb)) {
+                record.status = "failed";
+                break;
+            }
+            record.status = statuses[run.status];
+            record.iterations = run.iterations;
+            record.bank_terms = std::max(record.bank_terms, run.bank_terms);
+            record.peak_rss_kb = std::max(record.peak_rss_kb, peak_rss_kb);
+            times.push_back(run.us);
+        }
+        if (!times.empty()) {
+            std::sort(times.begin(), times.end());
+            record.median_us = bench_percentile(times, 50);
+            record.p95_us = bench_percentile(times, 95);
+        }
+
+        std::cout << record.path << ": " << record.status << " in " << record.iterations
+            << " iterations, median " << std::fixed << std::setprecision(2)
+            << record.median_us / 1000.0 << " ms, p95 " << record.p95_us / 1000.0
+            << std::defaultfloat << " ms, largest bank " << record.bank_terms << " terms, peak RSS "
+            << record.peak_rss_kb / 1024 << " MB" << std::endl;
+        records.push_back(record);
+    }
+
+    if (!bench_options.results_path.empty()) {
+        write_bench_records(bench_options.results_path, records);
+    }
+
+    if (!bench_options.compare_path.empty()) {
+        int32_t regressions = compare_bench(records,
+            read_bench_records(bench_options.compare_path), bench_options, std::cout);
+        std::cout << regressions << " regression(s) against " << bench_options.compare_path
+            << std::endl;
+        return regressions > 0 ? 1 : 0;
+    }
+    return 0;
+}
@@ -0,0 +1,330 @@
+// Records of benchmark runs (see bench.cpp), and comparison against a
+// baseline.
+//
+// Each spec gets one record per variant, with the median and 95th percentile
+// of its wall time over the repeats, and the CEGIS iterations, largest bank
+// and peak resident memory, which don't change between repeats since the
+// examples are drawn with a fixed seed. Records are written like pass stats
+// (see stats.hpp): as CSV if the file name ends with .csv, and as JSON lines
+// otherwise. Either can be read back as a baseline.
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "batch.hpp"
+
+struct BenchOptions {
+    // Which tier of specs to run: small, medium, large, or all.
+    std::string tier = "small";
+
+    // Number of times each spec is solved, and the seed its examples are
+    // drawn with.
+    int32_t repeats = 5;
+    uint64_t seed = 1;
+
+    // The list of specs, as "tier path" lines.
+    std::string specs_path = "bench_specs.txt";
+
+    // Where records are written, if anywhere, and the baseline they are
+    // compared against, if any.
+    std::string results_path;
+    std::string compare_path;
+
+    // A spec regresses if its median time or peak memory grows by more than
+    // this percentage, and its median time by at least min_ms or its peak
+    // memory by at least min_rss_mb, so that the noise of specs solved in a
+    // few milliseconds and megabytes isn't flagged.
+    double threshold_percent = 10;
+    uint64_t min_ms = 5;
+    uint64_t min_rss_mb = 4;
+
+    // If arg is a recognized option of the form --key=value, apply it and
+    // return true.
+    bool parse(const std::string &arg) {
+        std::string key = arg.substr(0, arg.find('='));
+        if (arg.find('=') == std::string::npos) {
+            return false;
+        }
+        std::string value = arg.substr(key.size() + 1);
+
+        try {
+            if (key == "--tier") {
+                tier = value;
+            } else if (key == "--repeats") {
+                repeats = std::max(1, std::stoi(value));
+            } else if (key == "--seed") {
+                seed = std::stoull(value);
+            } else if (key == "--specs") {
+                specs_path = value;
+            } else if (key == "--results") {
+                results_path = value;
+            } else if (key == "--compare") {
+                compare_path = value;
+            } else if (key == "--threshold") {
+                threshold_percent = std::stod(value);
+            } else if (key == "--min-ms") {
+                min_ms = std::stoull(value);
+            } else if (key == "--min-rss-mb") {
+                min_rss_mb = std::stoull(value);
+            } else {
+                return false;
+            }
+        } catch (const std::logic_error&) {
+            return false;
+        }
+        return true;
+    }
+};
+
+struct BenchCase {
+    std::string tier;
+    std::string path;
+};
+
+// Read the specs of the given tier, or of every tier if it is "all", from a
+// list of "tier path" lines. Empty lines and lines starting with # are
+// skipped.
+std::vector<BenchCase> read_bench_cases(const std::string &path, const std::string &tier) {
+    std::ifstream in(path);
+    if (!in) {
+        std::perror(path.c_str());
+        std::exit(1);
+    }
+
+    std::vector<BenchCase> cases;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        BenchCase bench_case;
+        if (line.empty() || line[0] == '#' || !(fields >> bench_case.tier >> bench_case.path)) {
+            continue;
+        }
+        if (tier == "all" || bench_case.tier == tier) {
+            cases.push_back(bench_case);
+        }
+    }
+    return cases;
+}
+
+struct BenchRecord {
+    std::string variant;
+    std::string tier;
+    std::string path;
+
+    // As in batch results, "skipped" if the spec has too many variables, or
+    // "failed" if a run crashed.
+    std::string status;
+
+    int32_t repeats;
+    // Wall time, in microseconds.
+    uint64_t median_us;
+    uint64_t p95_us;
+    int32_t iterations;
+    int64_t bank_terms;
+    uint64_t peak_rss_kb;
+};
+
+// The nearest-rank percentile of sorted values.
+uint64_t bench_percentile(const std::vector<uint64_t> &sorted, double percent) {
+    size_t rank = (size_t) std::ceil(percent / 100 * sorted.size());
+    return sorted[std::min(std::max(rank, (size_t) 1), sorted.size()) - 1];
+}
+
+bool bench_csv(const std::string &path) {
+    return path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+}
+
+#define BENCH_CSV_HEADER \
+    "variant,tier,path,status,repeats,median_us,p95_us,iterations,bank_terms,peak_rss_kb"
+
+// Write records to path, replacing its contents.
+void write_bench_records(const std::string &path, const std::vector<BenchRecord> &records) {
+    std::ofstream out(path);
+    if (!out) {
+        std::perror(path.c_str());
+        return;
+    }
+
+    if (bench_csv(path)) {
+        out << BENCH_CSV_HEADER << "\n";
+    }
+    for (const BenchRecord &record : records) {
+        if (bench_csv(path)) {
+            out << record.variant << "," << record.tier << "," << record.path << ","
+                << record.status << "," << record.repeats << "," << record.median_us << ","
+                << record.p95_us << "," << record.iterations << "," << record.bank_terms << ","
+                << record.peak_rss_kb << "\n";
+        } else {
+            out << "{\"variant\": " << json_string(record.variant)
+                << ", \"tier\": " << json_string(record.tier)
+                << ", \"path\": " << json_string(record.path)
+                << ", \"status\": " << json_string(record.status)
+                << ", \"repeats\": " << record.repeats
+                << ", \"median_us\": " << record.median_us
+                << ", \"p95_us\": " << record.p95_us
+                << ", \"iterations\": " << record.iterations
+                << ", \"bank_terms\": " << record.bank_terms
+                << ", \"peak_rss_kb\": " << record.peak_rss_kb << "}\n";
+        }
+    }
+}
+
+// Return the fields of a line written by write_bench_records, by name. Only
+// the flat objects written there are understood, whose strings are paths and
+// names without quotes or commas.
+std::map<std::string, std::string> bench_fields(const std::string &line,
+        const std::vector<std::string> &header) {
+    std::map<std::string, std::string> fields;
+    if (!header.empty()) {
+        std::istringstream values(line);
+        std::string value;
+        for (size_t i = 0; i < header.size() && std::getline(values, value, ','); i++) {
+            fields[header[i]] = value;
+        }
+        return fields;
+    }
+
+    std::istringstream members(line.substr(1, line.rfind('}') - 1));
+    std::string member;
+    while (std::getline(members, member, ',')) {
+        size_t colon = member.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        auto unquote = [](std::string text) {
+            text.erase(0, text.find_first_not_of(" \""));
+            text.erase(text.find_last_not_of(" \"") + 1);
+            return text;
+        };
+        fields[unquote(member.substr(0, colon))] = unquote(member.substr(colon + 1));
+    }
+    return fields;
+}
+
+// Read the records in a file written by write_bench_records.
+std::vector<BenchRecord> read_bench_records(const std::string &path) {
+    std::ifstream in(path);
+    if (!in) {
+        std::perror(path.c_str());
+        std::exit(1);
+    }
+
+    std::vector<std::string> header;
+    std::vector<BenchRecord> records;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        if (bench_csv(path) && header.empty()) {
+            std::istringstream names(line);
+            std::string name;
+            while (std::getline(names, name, ',')) {
+                header.push_back(name);
+            }
+            continue;
+        }
+
+        std::map<std::string, std::string> fields = bench_fields(line, header);
+        auto number = [&](const char* name) {
+            return fields.count(name) ? std::stoull(fields[name]) : 0;
+        };
+        records.push_back({fields["variant"], fields["tier"], fields["path"], fields["status"],
+                (int32_t) number("repeats"), number("median_us"), number("p95_us"),
+                (int32_t) number("iterations"), (int64_t) number("bank_terms"),
+                number("peak_rss_kb")});
+    }
+    return records;
+}
+
+// Compare records against the baseline records of the same variant and
+// spec, write a line for every difference to out, and return the number of
+// regressions: specs whose status changed, or whose median time or peak
+// memory grew beyond the threshold. A change in the number of iterations is
+// reported but isn't a regression, since it means the examples differ. So are
+// baseline specs of the same variant and tiers that weren't run, since it
+// means the list of specs differs.
+int32_t compare_bench(const std::vector<BenchRecord> &records,
+        const std::vector<BenchRecord> &baseline, const BenchOptions &options,
+        std::ostream &out) {
+    std::map<std::pair<std::string, std::string>, BenchRecord> base;
+    for (const BenchRecord &record : baseline) {
+        base[{record.variant, record.path}] = record;
+    }
+
+    double limit = 1 + options.threshold_percent / 100;
+    auto change = [](uint64_t now, uint64_t before) {
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(1)
+            << (before > 0 ? 100.0 * ((double) now - before) / before : 0) << "%";
+        return text.str();
+    };
+
+    int32_t regressions = 0;
+    for (const BenchRecord &record : records) {
+        auto it = base.find({record.variant, record.path});
+        if (it == base.end()) {
+            out << "new\t" << record.path << std::endl;
+            continue;
+        }
+        const BenchRecord &before = it->second;
+
+        if (record.status != before.status) {
+            out << "REGRESSION\t" << record.path << ": " << record.status
+                << ", was " << before.status << std::endl;
+            regressions++;
+        }
+        if (record.median_us > before.median_us * limit
+                && record.median_us - before.median_us >= options.min_ms * 1000) {
+            out << "REGRESSION\t" << record.path << ": median " << record.median_us
+                << " us, was " << before.median_us << " us ("
+                << change(record.median_us, before.median_us) << ")" << std::endl;
+            regressions++;
+        } else if (record.median_us * limit < before.median_us
+                && before.median_us - record.median_us >= options.min_ms * 1000) {
+            out << "faster\t" << record.path << ": median " << record.median_us
+                << " us, was " << before.median_us << " us ("
+                << change(record.median_us, before.median_us) << ")" << std::endl;
+        }
+        if (record.peak_rss_kb > before.peak_rss_kb * limit
+                && record.peak_rss_kb - before.peak_rss_kb >= options.min_rss_mb * 1024) {
+            out << "REGRESSION\t" << record.path << ": peak RSS " << record.peak_rss_kb
+                << " KB, was " << before.peak_rss_kb << " KB ("
+                << change(record.peak_rss_kb, before.peak_rss_kb) << ")" << std::endl;
+            regressions++;
+        }
+        if (record.iterations != before.iterations) {
+            out << "changed\t" << record.path << ": " << record.iterations
+                << " iterations, was " << before.iterations << std::endl;
+        }
+    }
+
+    std::set<std::pair<std::string, std::string>> run;
+    std::set<std::pair<std::string, std::string>> tiers;
+    for (const BenchRecord &record : records) {
+        run.insert({record.variant, record.path});
+        tiers.insert({record.variant, record.tier});
+    }
+    for (const BenchRecord &record : baseline) {
+        if (tiers.count({record.variant, record.tier}) && !run.count({record.variant, record.path})) {
+            out << "missing\t" << record.path << ": in the baseline, but not run" << std::endl;
+        }
+    }
+    return regressions;
+}
+
+#endif
@@ -0,0 +1,144 @@
+// Measure the effect of each allocation policy (see AllocPolicy) on random
+// probes into a large bitset, which is how the synthesizers use seen.
+//
+// Usage: bench_alloc [megabytes] [probes]
+//
+// For each policy, prints the time to allocate the bitset (which includes
+// faulting it in, if prefaulting), the time for the probes, and the number of
+// data TLB misses during the probes, if the kernel allows counting them.
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "alloc.hpp"
+#include "options.hpp"
+#include "timer.hpp"
+
+// Counts data TLB read misses in this process, if possible.
+class TlbMissCounter {
+private:
+    int fd;
+
+public:
+    TlbMissCounter() {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    ~TlbMissCounter() {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+
+    bool available() const {
+        return fd != -1;
+    }
+
+    void start() {
+        if (fd != -1) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    uint64_t stop() {
+        uint64_t count = 0;
+        if (fd != -1) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+                count = 0;
+            }
+        }
+        return count;
+    }
+};
+
+int main(int argc, char *argv[]) {
+    size_t megabytes = argc > 1 ? std::stoull(argv[1]) : 512;
+    uint64_t num_probes = argc > 2 ? std::stoull(argv[2]) : 100000000;
+    size_t size = megabytes << 20;
+
+    struct {
+        const char* name;
+        AllocPolicy policy;
+    } policies[] = {
+        {"normal", {PageSize::Normal, false}},
+        {"normal+prefault", {PageSize::Normal, true}},
+        {"thp", {PageSize::Transparent, false}},
+        {"thp+prefault", {PageSize::Transparent, true}},
+        {"2m", {PageSize::Huge2M, false}},
+        {"2m+prefault", {PageSize::Huge2M, true}},
+        {"1g", {PageSize::Huge1G, false}},
+    };
+
+    TlbMissCounter counter;
+    if (!counter.available()) {
+        std::cerr << "TLB misses can't be counted: " << std::strerror(errno) << std::endl;
+    }
+
+    std::cout << std::left << std::setw(18) << "policy"
+        << std::setw(12) << "alloc ms" << std::setw(12) << "probe ms"
+        << "dTLB misses" << std::endl;
+
+    for (auto &[name, policy] : policies) {
+        set_alloc_policy(policy);
+
+        Timer alloc_timer;
+        Mapping mapping = map_anonymous(size);
+        uint64_t alloc_ms = alloc_timer.ms();
+        uint8_t* bytes = (uint8_t*) mapping.ptr;
+
+        // The same sequence of probes for every policy.
+        uint64_t state = 0x9e3779b97f4a7c15ULL;
+        uint64_t hits = 0;
+        Timer probe_timer;
+        counter.start();
+        for (uint64_t i = 0; i < num_probes; i++) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            uint64_t bit = state % (size * 8);
+            uint8_t mask = 1 << (bit % 8);
+            hits += (bytes[bit / 8] & mask) != 0;
+            bytes[bit / 8] |= mask;
+        }
+        uint64_t misses = counter.stop();
+        uint64_t probe_ms = probe_timer.ms();
+
+        munmap(mapping.ptr, mapping.size);
+
+        std::cout << std::left << std::setw(18) << name
+            << std::setw(12) << alloc_ms << std::setw(12) << probe_ms;
+        if (counter.available()) {
+            std::cout << misses;
+        } else {
+            std::cout << "n/a";
+        }
+        std::cout << std::endl;
+
+        // Keep the probes from being optimized away.
+        if (hits == num_probes + 1) {
+            std::cout << std::endl;
+        }
+    }
+}
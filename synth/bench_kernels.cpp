@@ -0,0 +1,406 @@
+// Microbenchmarks of the synthesizer kernels, one at a time, so that each can
+// be tuned in isolation.
+//
+// Usage: bench_kernels_cpu_st [filter]
+//
+// Runs every benchmark whose name contains filter, or all of them, and prints
+// the time and the heap memory allocated per operation. The inputs are
+// synthetic, with parameters that control how results are distributed:
+//
+// - test_and_set on each bitset, at sizes that fit in L1, in L2 and in
+//   neither, with a given fraction of probes hitting bits that are set.
+// - The mapping from tile numbers to rows and columns of the trapezoid that
+//   binary passes cover (see trapezoid_tile).
+// - Binary passes, run by the synthesizer variant on random variables, so the
+//   bank grows from pass to pass. An operation is an operand pair; the time
+//   per new term includes add_binary_terms, and is dominated by it when most
+//   pairs are new.
+// - Expr::eval, Expr::eval_bits, ExprEvaluator::eval_bits and
+//   Spec::counterexample, on random expressions.
+//
+// Heap memory is counted by the operator new below, as in Go's benchmarks.
+// The bank and seen are mapped up front (see alloc.hpp), so passes only
+// allocate for their bookkeeping.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bitset.hpp"
+#include "expr.hpp"
+#include "options.hpp"
+#include "spec.hpp"
+#include "stats.hpp"
+#include "timer.hpp"
+#include "util.hpp"
+
+#ifndef SYNTH_VARIANT
+#error "SYNTH_VARIANT must be defined. See the Makefile."
+#elif SYNTH_VARIANT == 1
+#include "synth_cpu_st.hpp"
+#define VARIANT_DESCRIPTION "CPU, single threaded"
+#elif SYNTH_VARIANT == 2
+#include "synth_cpu_mt.hpp"
+#define VARIANT_DESCRIPTION "CPU, multi-threaded"
+#else
+#error "Unsupported SYNTH_VARIANT."
+#endif
+
+// Bytes allocated with operator new so far.
+std::atomic<uint64_t> allocated_bytes(0);
+
+// These aren't inlined, so that the compiler doesn't pair the free in
+// operator delete with new expressions, and warn about the mismatch.
+__attribute__((noinline)) void* operator new(size_t size) {
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    void* ptr = std::malloc(size > 0 ? size : 1);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+__attribute__((noinline)) void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+// Keeps the results of the benchmarks from being optimized away.
+uint64_t keep = 0;
+
+// xorshift64, as in bench_alloc.cpp.
+uint64_t next_random(uint64_t &state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+// Return true with the given probability.
+bool random_chance(uint64_t &state, double probability) {
+    return (next_random(state) >> 11) * 0x1.0p-53 < probability;
+}
+
+void print_header() {
+    std::cout << std::left << std::setw(56) << "benchmark" << std::setw(12) << "ops"
+        << std::setw(12) << "ns/op" << std::setw(12) << "bytes/op" << std::endl;
+}
+
+void report(const std::string &name, uint64_t ops, uint64_t ns, uint64_t bytes,
+        const std::string &notes = "") {
+    std::cout << std::left << std::setw(56) << name << std::setw(12) << ops
+        << std::fixed << std::setprecision(2)
+        << std::setw(12) << (double) ns / std::max(ops, (uint64_t) 1)
+        << std::setw(12) << (double) bytes / std::max(ops, (uint64_t) 1)
+        << std::defaultfloat << notes << std::endl;
+}
+
+// Run body, and add the time it took to ns and the heap memory it allocated
+// to bytes.
+template <typename Body>
+void measure(uint64_t &ns, uint64_t &bytes, Body body) {
+    uint64_t allocated = allocated_bytes.load(std::memory_order_relaxed);
+    Timer timer;
+    body();
+    ns += timer.ns();
+    bytes += allocated_bytes.load(std::memory_order_relaxed) - allocated;
+}
+
+// Probe a bitset of the given number of bits, where the fraction hit_rate of
+// the probes are to bits that are already set. Every even bit is set before
+// each round of probes, which go to even bits to hit and odd bits to miss. A
+// few odd bits are probed twice, so the measured hit rate is reported too.
+template <typename Bitset>
+void bench_test_and_set(const std::string &filter, const char* bitset_name, size_t size,
+        double hit_rate) {
+    std::ostringstream name;
+    name << bitset_name << "::test_and_set bits=2^" << __builtin_ctzll(size)
+        << " hits=" << (int32_t) (hit_rate * 100) << "%";
+    if (name.str().find(filter) == std::string::npos) {
+        return;
+    }
+
+    Bitset bitset(size);
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    std::vector<uint32_t> probes(std::min(size / 16, (size_t) 1 << 20));
+    for (uint32_t &probe : probes) {
+        bool hit = random_chance(state, hit_rate);
+        probe = next_random(state) % (size / 2) * 2 + (hit ? 0 : 1);
+    }
+
+    uint64_t ops = 0, ns = 0, bytes = 0, hits = 0;
+    while (ops < ((uint64_t) 1 << 24)) {
+        std::memset(bitset.data(), 0x55, size / 8);
+        measure(ns, bytes, [&]() {
+            for (uint32_t probe : probes) {
+                hits += bitset.test_and_set(probe);
+            }
+        });
+        ops += probes.size();
+    }
+
+    std::ostringstream notes;
+    notes << std::fixed << std::setprecision(1) << 100.0 * hits / ops << "% measured hits";
+    report(name.str(), ops, ns, bytes, notes.str());
+}
+
+// Map every tile of the trapezoid described by k and n to its row and
+// column, as a binary pass does for each of its tiles.
+void bench_trapezoid(const std::string &filter, int64_t k, int64_t n) {
+    std::ostringstream name;
+    name << "trapezoid_tile k=" << k << " n=" << n;
+    if (name.str().find(filter) == std::string::npos) {
+        return;
+    }
+
+    int64_t num_tiles = trapezoid_num_tiles(k, n);
+    uint64_t ops = 0, ns = 0;
+    while (ops < ((uint64_t) 1 << 26)) {
+        Timer timer;
+        for (int64_t b = 0; b < num_tiles; b++) {
+            int64_t row, column;
+            trapezoid_tile(b, k, n, row, column);
+            keep += row ^ column;
+        }
+        ns += timer.ns();
+        ops += num_tiles;
+    }
+    report(name.str(), ops, ns, 0);
+}
+
+// A spec with num_vars random variables over num_examples examples, where
+// each bit of a variable is 1 with the given probability. The first two
+// examples have the same inputs and different outputs, so there is no
+// solution, and every pass up to sol_height runs in full.
+Spec synthetic_spec(uint32_t num_vars, uint32_t num_examples, double density,
+        int32_t sol_height, uint64_t &state) {
+    std::vector<std::string> var_names;
+    std::vector<uint32_t> var_values;
+    for (uint32_t i = 0; i < num_vars; i++) {
+        uint32_t value = 0;
+        for (uint32_t example = 0; example < num_examples; example++) {
+            value |= (uint32_t) random_chance(state, density) << example;
+        }
+        var_names.push_back("v" + std::to_string(i));
+        var_values.push_back((value & ~2u) | (value & 1) << 1);
+    }
+    return Spec(num_vars, num_examples, var_names, std::vector<int32_t>(num_vars, 0),
+            var_values, 2, sol_height, {}, {});
+}
+
+// Run the binary passes of a synthetic spec (see synthetic_spec) up to the
+// given height, and report each of them. An operation is a pair of operands
+// (left, right) with left <= right, so the number of them only depends on the
+// size of the bank.
+void bench_passes(const std::string &filter, uint32_t num_vars, uint32_t num_examples,
+        double density, int32_t max_height) {
+    std::ostringstream prefix;
+    prefix << "vars=" << num_vars << " examples=" << num_examples << " density=" << density;
+    auto pass_name = [&](const std::string &pass, int32_t height) {
+        return "pass_" + pass + " " + prefix.str() + " height=" + std::to_string(height);
+    };
+    bool selected = false;
+    for (const char* pass : {"And", "Or", "XorSynth"}) {
+        for (int32_t height = 1; height <= max_height; height++) {
+            selected |= pass_name(pass, height).find(filter) != std::string::npos;
+        }
+    }
+    if (!selected) {
+        return;
+    }
+
+    uint64_t state = 0x9e3779b97f4a7c15ULL ^ num_vars;
+    Spec spec = synthetic_spec(num_vars, num_examples, density, max_height + 1, state);
+
+    // The end of the bank after the last pass of each height, and the heap
+    // memory allocated before the pass in progress.
+    std::map<int32_t, int64_t> height_ends;
+    uint64_t allocated = allocated_bytes.load(std::memory_order_relaxed);
+
+    std::ostream quiet(nullptr);
+    Options options;
+    options.log = &quiet;
+    options.on_pass = [&](const PassStats &stats) {
+        uint64_t bytes = allocated_bytes.load(std::memory_order_relaxed) - allocated;
+        std::string pass = stats.pass;
+        int64_t bank = stats.total_terms - stats.new_terms;
+        if (pass == "And" || pass == "Or" || pass == "XorSynth") {
+            // Lefts are every term of a lower height, and rights the terms of
+            // the height below.
+            int64_t lefts_end = height_ends[stats.height - 1];
+            int64_t rights_start = stats.height >= 2 ? height_ends[stats.height - 2] : 0;
+            int64_t rights = lefts_end - rights_start;
+            int64_t pairs = rights_start * rights + rights * (rights + 1) / 2;
+
+            std::string name = pass_name(pass, stats.height);
+            std::ostringstream notes;
+            notes << "bank " << bank << ", " << std::fixed << std::setprecision(1)
+                << 100.0 * (pairs - stats.new_terms) / std::max(pairs, (int64_t) 1)
+                << "% hits, " << std::setprecision(2)
+                << (double) stats.ns / std::max(stats.new_terms, (int64_t) 1) << " ns/new term";
+            if (name.find(filter) != std::string::npos) {
+                report(name, pairs, stats.ns, bytes, notes.str());
+            }
+        }
+        height_ends[stats.height] = stats.total_terms;
+        allocated = allocated_bytes.load(std::memory_order_relaxed);
+    };
+
+    ExprArena arena;
+    ExprArena::Scope scope(arena);
+    Synthesizer(spec, options).synthesize();
+}
+
+// A random expression of the given height over num_vars variables.
+const Expr* random_expr(int32_t height, uint32_t num_vars, uint64_t &state) {
+    if (height == 0) {
+        return Expr::Var(next_random(state) % num_vars);
+    }
+    const Expr* left = random_expr(height - 1, num_vars, state);
+    switch (next_random(state) % 4) {
+        case 0: return Expr::And(left, random_expr(height - 1, num_vars, state));
+        case 1: return Expr::Or(left, random_expr(height - 1, num_vars, state));
+        case 2: return Expr::Xor(left, random_expr(height - 1, num_vars, state));
+        default: return Expr::Not(left);
+    }
+}
+
+// Evaluate a random expression of the given height over num_vars variables,
+// on one input at a time with eval, on 64 at a time with eval_bits, once
+// flattened with ExprEvaluator, and on the whole truth table with
+// counterexample, which is correct everywhere, so every row is checked.
+void bench_eval(const std::string &filter, uint32_t num_vars, int32_t height) {
+    std::ostringstream suffix;
+    suffix << " vars=" << num_vars << " height=" << height;
+    ExprArena arena;
+    ExprArena::Scope scope(arena);
+    uint64_t state = 0x9e3779b97f4a7c15ULL ^ height;
+    const Expr* expr = random_expr(height, num_vars, state);
+    std::ostringstream nodes;
+    nodes << expr->postorder().size() << " nodes";
+
+    std::string name = "Expr::eval" + suffix.str();
+    if (name.find(filter) != std::string::npos) {
+        std::vector<std::vector<bool>> inputs(1024, std::vector<bool>(num_vars));
+        for (std::vector<bool> &input : inputs) {
+            for (uint32_t var = 0; var < num_vars; var++) {
+                input[var] = next_random(state) & 1;
+            }
+        }
+        uint64_t ops = 0, ns = 0, bytes = 0;
+        while (ops < ((uint64_t) 1 << 18)) {
+            measure(ns, bytes, [&]() {
+                for (const std::vector<bool> &input : inputs) {
+                    keep += expr->eval(input);
+                }
+            });
+            ops += inputs.size();
+        }
+        report(name, ops, ns, bytes, nodes.str());
+    }
+
+    name = "Expr::eval_bits" + suffix.str();
+    if (name.find(filter) != std::string::npos) {
+        std::vector<uint64_t> vars(num_vars);
+        uint64_t ops = 0, ns = 0, bytes = 0;
+        while (ops < ((uint64_t) 1 << 18)) {
+            for (uint64_t &var : vars) {
+                var = next_random(state);
+            }
+            measure(ns, bytes, [&]() { keep += expr->eval_bits(vars); });
+            ops++;
+        }
+        report(name, ops, ns, bytes, nodes.str() + ", 64 inputs per op");
+    }
+
+    name = "ExprEvaluator::eval_bits" + suffix.str();
+    if (name.find(filter) != std::string::npos) {
+        ExprEvaluator evaluator(expr);
+        std::vector<uint64_t> vars(num_vars);
+        uint64_t ops = 0, ns = 0, bytes = 0;
+        while (ops < ((uint64_t) 1 << 20)) {
+            for (uint64_t &var : vars) {
+                var = next_random(state);
+            }
+            measure(ns, bytes, [&]() { keep += evaluator.eval_bits(vars); });
+            ops++;
+        }
+        report(name, ops, ns, bytes, nodes.str() + ", 64 inputs per op");
+    }
+
+    name = "Spec::counterexample" + suffix.str();
+    if (name.find(filter) != std::string::npos) {
+        std::vector<std::vector<bool>> all_inputs;
+        std::vector<bool> all_sols;
+        for (uint32_t row = 0; row < (1u << num_vars); row++) {
+            std::vector<bool> input(num_vars);
+            for (uint32_t var = 0; var < num_vars; var++) {
+                input[var] = (row >> var) & 1;
+            }
+            all_sols.push_back(expr->eval(input));
+            all_inputs.push_back(input);
+        }
+        std::vector<std::string> var_names(num_vars, "v");
+        Spec spec(num_vars, 32, var_names, std::vector<int32_t>(num_vars, 0),
+                std::vector<uint32_t>(num_vars, 0), 0, height, all_inputs, all_sols);
+
+        uint64_t ops = 0, ns = 0, bytes = 0;
+        while (ops < ((uint64_t) 1 << 22) >> num_vars) {
+            measure(ns, bytes, [&]() { keep += spec.counterexample(expr); });
+            ops++;
+        }
+        std::ostringstream notes;
+        notes << nodes.str() << ", " << all_inputs.size() << " rows per op";
+        report(name, ops, ns, bytes, notes.str());
+    }
+}
+
+int main(int argc, char *argv[]) {
+    std::cerr << "Synthesizer variant: " << VARIANT_DESCRIPTION << std::endl;
+    std::string filter = argc > 1 ? argv[1] : "";
+
+    print_header();
+
+    for (size_t size : {(size_t) 1 << 16, (size_t) 1 << 20, (size_t) 1 << 30}) {
+        for (double hit_rate : {0.0, 0.5, 0.9, 0.99}) {
+            bench_test_and_set<SingleThreadedBitset>(filter, "SingleThreadedBitset", size,
+                    hit_rate);
+            bench_test_and_set<ThreadSafeBitset>(filter, "ThreadSafeBitset", size, hit_rate);
+        }
+    }
+
+    // A pass with a bank of k * TILE_SIZE terms below the height, and
+    // (n - k) * TILE_SIZE of it.
+    for (auto [k, n] : {std::pair<int64_t, int64_t>{0, 64}, {64, 128}, {1024, 1088},
+            {0, 4096}}) {
+        bench_trapezoid(filter, k, n);
+    }
+
+    // Denser variables, and fewer examples, make more results collide.
+    bench_passes(filter, 8, 24, 0.5, 2);
+    bench_passes(filter, 16, 24, 0.5, 2);
+    bench_passes(filter, 24, 24, 0.5, 2);
+    bench_passes(filter, 16, 24, 0.9, 2);
+    bench_passes(filter, 16, 12, 0.5, 2);
+
+    for (auto [num_vars, height] : {std::pair<uint32_t, int32_t>{8, 4}, {8, 8}, {16, 8}}) {
+        bench_eval(filter, num_vars, height);
+    }
+
+    if (keep == 1) {
+        std::cout << std::endl;
+    }
+}
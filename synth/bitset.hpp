@@ -12,15 +12,50 @@ protected:
     const size_t size;
     uint8_t* const bytes;
 
-    BaseBitset(const size_t size) :
+    // Whether every bit has been cleared by clear.
+    bool cleared;
+
+    // If shared is true, the bits are shared with processes forked later
+    // (see alloc_shared).
+    BaseBitset(const size_t size, bool shared) :
         size(size),
-        bytes((uint8_t*) alloc(CEIL_DIV(size, 8))) {}
+        bytes((uint8_t*) (shared ? alloc_shared(CEIL_DIV(size, 8)) : alloc(CEIL_DIV(size, 8)))),
+        cleared(false) {}
 
     ~BaseBitset() {
-        dealloc(bytes, CEIL_DIV(size, 8));
+        if (cleared) {
+            dealloc_zeroed(bytes, CEIL_DIV(size, 8));
+        } else {
+            dealloc(bytes, CEIL_DIV(size, 8));
+        }
     }
 
 public:
+    // The underlying bytes. The i'th bit is bit (i % 8) of byte (i / 8).
+    const uint8_t* data() const {
+        return bytes;
+    }
+
+    uint8_t* data() {
+        return bytes;
+    }
+
+    // Clear the given bits, which must include every bit that is set, before
+    // the bitset is destroyed. Then its memory can be reused without zeroing
+    // all of it (see RegionPool). This is skipped if there are so many bits
+    // that zeroing everything is faster.
+    template <typename Index>
+    void clear(const Index* indices, int64_t count) {
+        // Each bit costs about a cache line.
+        if (count * 64 >= (int64_t) CEIL_DIV(size, 8)) {
+            return;
+        }
+        for (int64_t i = 0; i < count; i++) {
+            bytes[indices[i] / 8] = 0;
+        }
+        cleared = true;
+    }
+
     // Get the bit at the specified index.
     bool test(uint32_t index) {
         return (bytes[index / 8] >> (index % 8)) & 1;
@@ -29,7 +64,7 @@ public:
 
 class SingleThreadedBitset : public BaseBitset {
 public:
-    SingleThreadedBitset(const size_t size) : BaseBitset(size) {}
+    SingleThreadedBitset(const size_t size, bool shared = false) : BaseBitset(size, shared) {}
 
     // Set the bit at the specified index,
     // and return the previous value of that bit.
@@ -53,7 +88,7 @@ public:
 
 class ThreadSafeBitset : public BaseBitset {
 public:
-    ThreadSafeBitset(const size_t size) : BaseBitset(size) {}
+    ThreadSafeBitset(const size_t size, bool shared = false) : BaseBitset(size, shared) {}
 
     // Atomically set the bit at the specified index,
     // and return the previous value of that bit.
@@ -0,0 +1,67 @@
+// Budgets that bound a synthesis run (see Options::time_limit_ms, max_terms
+// and max_memory_bytes).
+//
+// Passes check the budgets between tiles, along with Options::cancel, so a
+// run that exceeds one stops within a tile, as though there were no solution,
+// and reports which budget it exceeded and how far it got. The memory budget
+// is charged for what the synthesizer allocates, which is computed from the
+// size of the bank (see AbstractSynthesizer::estimated_bytes), so it is cheap
+// enough to check for every tile, and doesn't depend on other jobs in the
+// same process.
+
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+#include "options.hpp"
+
+enum class BudgetLimit {
+    None,
+    Time,
+    Terms,
+    Memory,
+};
+
+const char* budget_limit_name(BudgetLimit limit) {
+    switch (limit) {
+        case BudgetLimit::None: return "none";
+        case BudgetLimit::Time: return "time";
+        case BudgetLimit::Terms: return "terms";
+        case BudgetLimit::Memory: return "memory";
+    }
+    return "";
+}
+
+// The budget that stopped synthesis, if any, with the height of the pass it
+// stopped in and the number of terms in the bank at the time.
+struct BudgetStatus {
+    BudgetLimit limit = BudgetLimit::None;
+    int32_t height = 0;
+    int64_t num_terms = 0;
+
+    bool exceeded() const {
+        return limit != BudgetLimit::None;
+    }
+
+    void print(std::ostream &out) const {
+        out << budget_limit_name(limit) << " budget exceeded at height " << height
+            << " with " << num_terms << " terms";
+    }
+};
+
+// Return options with the deadline set from time_limit_ms, counting from now,
+// unless it is already set. Called when a run starts, so that the time limit
+// covers every synthesizer of the run.
+Options start_budget(Options options) {
+    if (options.time_limit_ms > 0
+            && options.deadline == std::chrono::steady_clock::time_point::max()) {
+        options.deadline = std::chrono::steady_clock::now()
+            + std::chrono::milliseconds(options.time_limit_ms);
+    }
+    return options;
+}
+
+#endif
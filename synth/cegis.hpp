@@ -0,0 +1,166 @@
+// Counterexample-guided inductive synthesis on top of any synthesizer variant.
+
+#ifndef CEGIS_H
+#define CEGIS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+
+#include "budget.hpp"
+#include "expr.hpp"
+#include "options.hpp"
+#include "solution_cache.hpp"
+#include "spec.hpp"
+
+// Repeatedly synthesize a solution for the current examples, and replace one
+// of the examples with a counterexample from the full truth table, until the
+// solution is correct on every input. The solution is nullptr if the
+// synthesizer can't find a solution for some set of examples. Candidates are
+// written to log, if it is not nullptr, and passed to options.on_candidate, if
+// it is set. If options.cache_dir is set, a cached solution is used if there
+// is one, and new solutions are added to the cache. The time limit of
+// options (see budget.hpp) covers every iteration.
+//
+// Synthesis is done a bounded amount at a time by step, so that a host can
+// interleave several specs, or other work, on the same threads.
+template <typename Synth>
+class Cegis {
+private:
+    Spec &spec;
+    std::ostream* log;
+    const Options options;
+    SolutionCache cache;
+
+    // The synthesizer for the current examples, once started.
+    std::unique_ptr<Synth> synthesizer;
+
+    bool started;
+    bool finished;
+    const Expr* expr;
+    int32_t iterations;
+    BudgetStatus budget;
+    int64_t largest_bank_terms;
+
+    void finish() {
+        finished = true;
+        if (expr != nullptr && !options.cache_dir.empty()) {
+            cache.store(spec, expr);
+        }
+    }
+
+public:
+    Cegis(Spec &spec, std::ostream *log, const Options &options = Options()) :
+        spec(spec),
+        log(log),
+        options(start_budget(options)),
+        cache(options.cache_dir, options.cache_max_bytes, *options.log),
+        started(false),
+        finished(false),
+        expr(nullptr),
+        iterations(0),
+        largest_bank_terms(0) {}
+
+    // Do at most max_tiles tiles of synthesis (see AbstractSynthesizer::step),
+    // and return true once the solution is known.
+    bool step(int64_t max_tiles) {
+        if (!started) {
+            started = true;
+            if (!options.cache_dir.empty()) {
+                expr = cache.lookup(spec);
+                if (expr != nullptr) {
+                    if (log != nullptr) {
+                        *log << "Cached solution: ";
+                        expr->print(*log, &spec.var_names);
+                        *log << std::endl;
+                    }
+                    if (options.on_candidate) {
+                        options.on_candidate(expr);
+                    }
+                    // Already in the cache, so finish isn't needed.
+                    finished = true;
+                    return true;
+                }
+            }
+        }
+
+        if (finished) {
+            return true;
+        }
+
+        // Each call runs at most one synthesizer, so that the work done
+        // stays bounded by max_tiles.
+        if (synthesizer == nullptr) {
+            synthesizer = std::make_unique<Synth>(spec, options);
+        }
+        if (!synthesizer->step(max_tiles)) {
+            return false;
+        }
+
+        expr = synthesizer->solution();
+        budget = synthesizer->budget_status();
+        largest_bank_terms = std::max(largest_bank_terms, synthesizer->bank_size());
+        synthesizer.reset();
+        if (expr == nullptr) {
+            finish();
+            return true;
+        }
+        if (options.on_candidate) {
+            options.on_candidate(expr);
+        }
+
+        int counter_example = spec.advanceCEGISIteration(expr);
+        if (counter_example == -1) {
+            finish();
+            return true;
+        }
+
+        if (log != nullptr) {
+            *log << "Candidate (counterexample found " << counter_example << "): ";
+            expr->print(*log, &spec.var_names);
+            *log << std::endl;
+        }
+
+        iterations++;
+        return false;
+    }
+
+    // The solution, or nullptr if there is none. Only valid once step has
+    // returned true.
+    const Expr* solution() const {
+        return expr;
+    }
+
+    // The number of counterexamples found so far.
+    int32_t num_iterations() const {
+        return iterations;
+    }
+
+    // Which budget stopped synthesis, if any. Only valid once step has
+    // returned true.
+    const BudgetStatus& budget_status() const {
+        return budget;
+    }
+
+    // The number of terms in the largest bank of any iteration so far.
+    int64_t largest_bank() const {
+        return largest_bank_terms;
+    }
+};
+
+// Run Cegis to completion, and return its solution. If budget isn't nullptr,
+// it is set to the budget that stopped synthesis, if any.
+template <typename Synth>
+const Expr* cegis(Spec &spec, std::ostream *log, int32_t &iterations,
+        const Options &options = Options(), BudgetStatus* budget = nullptr) {
+    Cegis<Synth> run(spec, log, options);
+    while (!run.step(INT64_MAX)) {}
+    iterations = run.num_iterations();
+    if (budget != nullptr) {
+        *budget = run.budget_status();
+    }
+    return run.solution();
+}
+
+#endif
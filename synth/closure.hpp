@@ -0,0 +1,375 @@
+// Synthesizer for specs with at most 8 examples.
+//
+// With 8 examples there are only 256 distinct results, so instead of a bank of
+// terms, we keep the set of results reachable at each height as a 256-bit set,
+// and compute the next height's set with word-parallel set operations. For
+// each result we only remember how it was first reached, which is enough to
+// reconstruct an expression. Most CEGIS iterations have this few examples.
+
+#ifndef CLOSURE_H
+#define CLOSURE_H
+
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+
+#include "expr.hpp"
+#include "spec.hpp"
+#include "timer.hpp"
+
+#define CLOSURE_MAX_EXAMPLES 8
+
+// ANDs and ORs are found by trying every pair of operands while there are
+// fewer than this many lower results, and with set operations after that,
+// which cost the same for any number of operands.
+#define CLOSURE_MIN_IMAGE_OPERANDS 32
+
+// A set of 8-bit results.
+struct ResultSet {
+    uint64_t words[4] = {0, 0, 0, 0};
+
+    bool test(uint32_t result) const {
+        return (words[result / 64] >> (result % 64)) & 1;
+    }
+
+    void set(uint32_t result) {
+        words[result / 64] |= 1ULL << (result % 64);
+    }
+
+    bool empty() const {
+        return (words[0] | words[1] | words[2] | words[3]) == 0;
+    }
+
+    int32_t count() const {
+        return __builtin_popcountll(words[0]) + __builtin_popcountll(words[1])
+            + __builtin_popcountll(words[2]) + __builtin_popcountll(words[3]);
+    }
+
+    ResultSet operator&(const ResultSet &other) const {
+        ResultSet set;
+        for (int32_t i = 0; i < 4; i++) {
+            set.words[i] = words[i] & other.words[i];
+        }
+        return set;
+    }
+
+    ResultSet operator~() const {
+        ResultSet set;
+        for (int32_t i = 0; i < 4; i++) {
+            set.words[i] = ~words[i];
+        }
+        return set;
+    }
+
+    // The bits of a word for the elements whose bit k is clear, for k < 6.
+    // The other 2^k bits of each block of 2^(k + 1) are for those elements
+    // with bit k set.
+    static uint64_t low_half(int32_t k) {
+        static const uint64_t low_halves[6] = {
+            0x5555555555555555ULL,
+            0x3333333333333333ULL,
+            0x0f0f0f0f0f0f0f0fULL,
+            0x00ff00ff00ff00ffULL,
+            0x0000ffff0000ffffULL,
+            0x00000000ffffffffULL,
+        };
+        return low_halves[k];
+    }
+
+    // Return {s ^ value : s in this set}. Flipping bit k of every element
+    // swaps adjacent blocks of 2^k bits, so this takes a few shifts per word.
+    ResultSet xor_translate(uint32_t value) const {
+        ResultSet set;
+        for (int32_t i = 0; i < 4; i++) {
+            uint64_t word = words[i];
+            for (int32_t k = 0; k < 6; k++) {
+                if ((value >> k) & 1) {
+                    uint32_t shift = 1 << k;
+                    word = ((word & low_half(k)) << shift)
+                        | ((word >> shift) & low_half(k));
+                }
+            }
+            set.words[i ^ (value >> 6)] = word;
+        }
+        return set;
+    }
+
+    // Return {s & value : s in this set}. Clearing bit k of every element
+    // moves the blocks of elements that have it onto those that don't, so
+    // like xor_translate, this takes a few shifts per word.
+    ResultSet and_image(uint32_t value) const {
+        ResultSet set = *this;
+        for (int32_t k = 0; k < 8; k++) {
+            if ((value >> k) & 1) {
+                continue;
+            }
+            if (k < 6) {
+                uint32_t shift = 1 << k;
+                for (uint64_t &word : set.words) {
+                    word = (word | (word >> shift)) & low_half(k);
+                }
+            } else {
+                int32_t bit = 1 << (k - 6);
+                for (int32_t i = 0; i < 4; i++) {
+                    if (i & bit) {
+                        set.words[i ^ bit] |= set.words[i];
+                        set.words[i] = 0;
+                    }
+                }
+            }
+        }
+        return set;
+    }
+
+    // Return {s | value : s in this set}, moving elements the other way.
+    ResultSet or_image(uint32_t value) const {
+        ResultSet set = *this;
+        for (int32_t k = 0; k < 8; k++) {
+            if (!((value >> k) & 1)) {
+                continue;
+            }
+            if (k < 6) {
+                uint32_t shift = 1 << k;
+                for (uint64_t &word : set.words) {
+                    word = (word | (word << shift)) & ~low_half(k);
+                }
+            } else {
+                int32_t bit = 1 << (k - 6);
+                for (int32_t i = 0; i < 4; i++) {
+                    if (!(i & bit)) {
+                        set.words[i | bit] |= set.words[i];
+                        set.words[i] = 0;
+                    }
+                }
+            }
+        }
+        return set;
+    }
+
+    // Call f on every element, in increasing order.
+    template <typename F>
+    void for_each(F f) const {
+        for (int32_t i = 0; i < 4; i++) {
+            uint64_t word = words[i];
+            while (word != 0) {
+                f(i * 64 + __builtin_ctzll(word));
+                word &= word - 1;
+            }
+        }
+    }
+};
+
+class ClosureSynthesizer {
+private:
+    enum class Kind : uint8_t {
+        Variable,
+        Not,
+        And,
+        Or,
+        Xor,
+    };
+
+    Spec spec;
+
+    std::ostream &log;
+
+    // Bitmask indicating which bits contain valid examples.
+    const uint32_t result_mask;
+
+    // Every result reached so far.
+    ResultSet reached;
+
+    // How each reached result was first reached: the kind of term, its
+    // height, and its operands, which are results that were reached at a
+    // lower height. For variables, left is the variable number. The left
+    // operands of ANDs and ORs are found when reconstructing, since only a
+    // few of them are needed.
+    Kind kinds[256];
+    int32_t heights[256];
+    uint32_t lefts[256];
+    uint8_t rights[256];
+
+    int32_t num_terms;
+
+    // Record a result, and return true if it is the solution.
+    bool add(uint32_t result, int32_t height, Kind kind, uint32_t left, uint32_t right) {
+        assert(!reached.test(result));
+        reached.set(result);
+        kinds[result] = kind;
+        heights[result] = height;
+        lefts[result] = left;
+        rights[result] = right;
+        num_terms++;
+        return result == spec.sol_result;
+    }
+
+    // Reach every result of the given height, given the results of lower
+    // heights (prevs) and those of height `height - 1` (news). Returns true
+    // if the solution was reached.
+    bool close(int32_t height, const ResultSet &prevs, const ResultSet &news) {
+        for (uint32_t i = 0; i < spec.num_vars; i++) {
+            uint32_t result = spec.var_values[i];
+            if (spec.var_heights[i] == height && !reached.test(result)
+                    && add(result, height, Kind::Variable, i, 0)) {
+                return true;
+            }
+        }
+
+        if (height == 0) {
+            return false;
+        }
+
+        // Every new term needs an operand of height `height - 1`; otherwise
+        // it would have been reached at a lower height.
+        bool found = false;
+        bool few_prevs = prevs.count() < CLOSURE_MIN_IMAGE_OPERANDS;
+        news.for_each([&](uint32_t right) {
+            if (found) {
+                return;
+            }
+
+            uint32_t not_result = result_mask & ~right;
+            if (!reached.test(not_result) && add(not_result, height, Kind::Not, right, 0)) {
+                found = true;
+                return;
+            }
+
+            // The results of every pair with this right operand are found
+            // with set operations, and only the new ones are visited. ANDs
+            // and ORs of few operands are cheaper to find pair by pair.
+            ResultSet xors = prevs.xor_translate(right) & ~reached;
+            xors.for_each([&](uint32_t result) {
+                if (!found && add(result, height, Kind::Xor, result ^ right, right)) {
+                    found = true;
+                }
+            });
+
+            if (few_prevs) {
+                prevs.for_each([&](uint32_t left) {
+                    if (found) {
+                        return;
+                    }
+                    uint32_t and_result = left & right;
+                    if (!reached.test(and_result)
+                            && add(and_result, height, Kind::And, 0, right)) {
+                        found = true;
+                        return;
+                    }
+                    uint32_t or_result = left | right;
+                    if (!reached.test(or_result)
+                            && add(or_result, height, Kind::Or, 0, right)) {
+                        found = true;
+                    }
+                });
+                return;
+            }
+
+            ResultSet ands = prevs.and_image(right) & ~reached;
+            ands.for_each([&](uint32_t result) {
+                if (!found && add(result, height, Kind::And, 0, right)) {
+                    found = true;
+                }
+            });
+
+            ResultSet ors = prevs.or_image(right) & ~reached;
+            ors.for_each([&](uint32_t result) {
+                if (!found && add(result, height, Kind::Or, 0, right)) {
+                    found = true;
+                }
+            });
+        });
+        return found;
+    }
+
+    // Return a result reached below the given height for which matches
+    // returns true, which must exist.
+    template <typename F>
+    uint32_t find_left(int32_t height, F matches) const {
+        for (uint32_t left = 0; left <= result_mask; left++) {
+            if (reached.test(left) && heights[left] < height && matches(left)) {
+                return left;
+            }
+        }
+        assert(false);
+        return 0;
+    }
+
+    const Expr* reconstruct(uint32_t result, const Expr** memo) {
+        if (memo[result] != nullptr) {
+            return memo[result];
+        }
+
+        const Expr* expr = nullptr;
+        switch (kinds[result]) {
+            case Kind::Variable:
+                expr = Expr::Var(lefts[result]);
+                break;
+            case Kind::Not:
+                expr = Expr::Not(reconstruct(lefts[result], memo));
+                break;
+            case Kind::And: {
+                uint32_t right = rights[result];
+                uint32_t left = find_left(heights[result],
+                        [&](uint32_t candidate) { return (candidate & right) == result; });
+                expr = Expr::And(reconstruct(left, memo), reconstruct(right, memo));
+                break;
+            }
+            case Kind::Or: {
+                uint32_t right = rights[result];
+                uint32_t left = find_left(heights[result],
+                        [&](uint32_t candidate) { return (candidate | right) == result; });
+                expr = Expr::Or(reconstruct(left, memo), reconstruct(right, memo));
+                break;
+            }
+            case Kind::Xor:
+                expr = Expr::Xor(reconstruct(lefts[result], memo),
+                        reconstruct(rights[result], memo));
+                break;
+        }
+
+        memo[result] = expr;
+        return expr;
+    }
+
+public:
+    // Progress is written to log.
+    ClosureSynthesizer(Spec spec, std::ostream &log = std::cerr) :
+            spec(spec),
+            log(log),
+            result_mask((1U << spec.num_examples) - 1),
+            num_terms(0) {
+        assert(spec.num_examples <= CLOSURE_MAX_EXAMPLES);
+        assert((spec.sol_result & ~result_mask) == 0);
+    }
+
+    // Return an Expr satisfying spec, or nullptr if it cannot be found.
+    const Expr* synthesize() {
+        Timer timer;
+
+        bool found = false;
+        ResultSet prevs;
+        for (int32_t height = 0; height <= spec.sol_height && !found; height++) {
+            int32_t prev_num_terms = num_terms;
+            ResultSet news = reached & ~prevs;
+            prevs = reached;
+            found = close(height, prevs, news);
+
+            log << "height " << height << ", closure: "
+                << (num_terms - prev_num_terms) << " new term(s), "
+                << num_terms << " total term(s)" << std::endl;
+        }
+
+        uint64_t ms = timer.ms();
+        log << ms << " ms, "
+            << num_terms << " terms" << std::endl;
+
+        if (!found) {
+            return nullptr;
+        }
+
+        const Expr* memo[256] = {};
+        return reconstruct(spec.sol_result, memo);
+    }
+};
+
+#endif
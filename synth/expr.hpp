@@ -5,9 +5,24 @@
 #include <cassert>
 #include <cstdint>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+class ExprArena;
+class ExprEvaluator;
+
+// Expressions are immutable and hash-consed: two structurally equal
+// expressions created in the same arena are the same object, so an Expr is a
+// DAG rather than a tree. Every method below visits each distinct
+// subexpression once.
 class Expr {
+    friend class ExprArena;
+    friend class ExprEvaluator;
+
 private:
     static const int32_t AND = -1;
     static const int32_t OR = -2;
@@ -24,29 +39,145 @@ private:
     Expr(const int32_t type, const Expr* left, const Expr* right) :
         type(type), left(left), right(right) {}
 
+    // Return the unique expression with the given fields in the current
+    // arena (see ExprArena::current).
+    static const Expr* make(int32_t type, const Expr* left, const Expr* right);
+
+    static const Expr* make_binary(int32_t type, const Expr* left, const Expr* right) {
+        switch (type) {
+            case Expr::AND:
+                return Expr::And(left, right);
+            case Expr::OR:
+                return Expr::Or(left, right);
+            case Expr::XOR:
+                return Expr::Xor(left, right);
+            default:
+                assert(false);
+                return nullptr;
+        }
+    }
+
+    bool is_binary() const {
+        return type == Expr::AND || type == Expr::OR || type == Expr::XOR;
+    }
+
+    int32_t height(const std::vector<int32_t> &var_heights,
+            std::unordered_map<const Expr*, int32_t> &memo) const {
+        auto it = memo.find(this);
+        if (it != memo.end()) {
+            return it->second;
+        }
+
+        int32_t result;
+        switch (type) {
+            case Expr::NOT:
+                result = 1 + left->height(var_heights, memo);
+                break;
+            case Expr::AND:
+            case Expr::OR:
+            case Expr::XOR:
+                result = 1 + std::max(left->height(var_heights, memo),
+                        right->height(var_heights, memo));
+                break;
+            default:
+                assert(0 <= type && (size_t) type < var_heights.size());
+                result = var_heights[type];
+                break;
+        }
+
+        memo[this] = result;
+        return result;
+    }
+
+    // Return an equivalent constant height expression, with the same height
+    // as this one.
+    const Expr* with_own_constant_height(const std::vector<int32_t> &var_heights,
+            std::unordered_map<const Expr*, int32_t> &heights,
+            std::unordered_map<const Expr*, const Expr*> &memo) const {
+        auto it = memo.find(this);
+        if (it != memo.end()) {
+            return it->second;
+        }
+
+        const Expr* new_expr;
+        switch (type) {
+            case Expr::NOT:
+                // Make the operand constant height.
+                new_expr = Expr::Not(left->with_own_constant_height(var_heights, heights, memo));
+                break;
+            case Expr::AND:
+            case Expr::OR:
+            case Expr::XOR: {
+                // Make both operands constant height.
+                const Expr* new_left = left->with_own_constant_height(var_heights, heights, memo);
+                const Expr* new_right = right->with_own_constant_height(var_heights, heights, memo);
+
+                // Make both operands the same height.
+                int32_t left_height = left->height(var_heights, heights);
+                int32_t right_height = right->height(var_heights, heights);
+                int32_t child_height = std::max(left_height, right_height);
+                new_left = new_left->pad_height(child_height - left_height);
+                new_right = new_right->pad_height(child_height - right_height);
+
+                new_expr = Expr::make_binary(type, new_left, new_right);
+                break;
+            }
+            default:
+                // Variables are left as-is.
+                new_expr = this;
+                break;
+        }
+
+        memo[this] = new_expr;
+        return new_expr;
+    }
+
+    const Expr* with_vars(const std::vector<int32_t> &var_map,
+            std::unordered_map<const Expr*, const Expr*> &memo) const {
+        auto it = memo.find(this);
+        if (it != memo.end()) {
+            return it->second;
+        }
+
+        const Expr* new_expr;
+        if (is_binary()) {
+            new_expr = Expr::make_binary(type,
+                    left->with_vars(var_map, memo), right->with_vars(var_map, memo));
+        } else if (type == Expr::NOT) {
+            new_expr = Expr::Not(left->with_vars(var_map, memo));
+        } else {
+            assert(0 <= type && (size_t) type < var_map.size());
+            new_expr = Expr::Var(var_map[type]);
+        }
+
+        memo[this] = new_expr;
+        return new_expr;
+    }
+
 public:
     // Static helpers to construct various expressions.
 
     static const Expr* And(const Expr *left, const Expr *right) {
-        return new Expr(Expr::AND, left, right);
+        return make(Expr::AND, left, right);
     }
 
     static const Expr* Or(const Expr *left, const Expr *right) {
-        return new Expr(Expr::OR, left, right);
+        return make(Expr::OR, left, right);
     }
 
     static const Expr* Xor(const Expr *left, const Expr *right) {
-        return new Expr(Expr::XOR, left, right);
+        return make(Expr::XOR, left, right);
     }
 
     static const Expr* Not(const Expr *left) {
-        return new Expr(Expr::NOT, left, nullptr);
+        return make(Expr::NOT, left, nullptr);
     }
 
     static const Expr* Var(int32_t var_num) {
-        return new Expr(var_num, nullptr, nullptr);
+        return make(var_num, nullptr, nullptr);
     }
 
+    // Printing expands shared subexpressions, since the output is a tree.
     void print(std::ostream &out, const std::vector<std::string> *var_names) const {
         switch (type) {
             case Expr::AND:
@@ -84,104 +215,216 @@ public:
         }
     }
 
-    int32_t height(const std::vector<int32_t> &var_heights) const {
-        switch (type) {
-            case Expr::NOT:
-                return 1 + left->height(var_heights);
-            case Expr::AND:
-            case Expr::OR:
-            case Expr::XOR:
-                return 1 + std::max(left->height(var_heights), right->height(var_heights));
-            default:
-                assert(0 <= type && (size_t) type < var_heights.size());
-                return var_heights[type];
+    // Return the distinct subexpressions of this expression, including
+    // itself, where every expression comes after its children.
+    std::vector<const Expr*> postorder() const {
+        std::vector<const Expr*> order;
+        std::unordered_set<const Expr*> visited;
+
+        // Each stack entry is an expression, and whether its children have
+        // already been pushed.
+        std::vector<std::pair<const Expr*, bool>> stack;
+        stack.push_back({this, false});
+        while (!stack.empty()) {
+            auto [expr, expanded] = stack.back();
+            stack.pop_back();
+            if (expanded) {
+                order.push_back(expr);
+                continue;
+            }
+            if (!visited.insert(expr).second) {
+                continue;
+            }
+            stack.push_back({expr, true});
+            if (expr->right != nullptr) {
+                stack.push_back({expr->right, false});
+            }
+            if (expr->left != nullptr) {
+                stack.push_back({expr->left, false});
+            }
         }
+
+        return order;
+    }
+
+    int32_t height(const std::vector<int32_t> &var_heights) const {
+        std::unordered_map<const Expr*, int32_t> memo;
+        return height(var_heights, memo);
     }
 
     const Expr* pad_height(int32_t amount) const {
         assert(amount >= 0);
-        switch (amount) {
-            case 0:
-                return this;
-            case 1:
-                return Expr::And(this, this);
-            default:
-                return Expr::Not(Expr::Not(pad_height(amount - 2)));
+        const Expr* expr = this;
+        if (amount % 2 == 1) {
+            expr = Expr::And(expr, expr);
+        }
+        for (int32_t i = 0; i < amount / 2; i++) {
+            expr = Expr::Not(Expr::Not(expr));
         }
+        return expr;
     }
 
     const Expr* with_constant_height(int32_t height, const std::vector<int32_t> &var_heights) const {
-        const Expr* new_expr;
+        std::unordered_map<const Expr*, int32_t> heights;
+        std::unordered_map<const Expr*, const Expr*> memo;
+        const Expr* new_expr = with_own_constant_height(var_heights, heights, memo);
+        int32_t own_height = this->height(var_heights, heights);
+        assert(own_height <= height);
+        return new_expr->pad_height(height - own_height);
+    }
 
-        switch (type) {
-            case Expr::NOT: {
-                // Make the operand constant height.
-                int32_t left_height = left->height(var_heights);
-                const Expr* new_left = left->with_constant_height(left_height, var_heights);
+    void assert_constant_height(int32_t height, const std::vector<int32_t> &var_heights) const {
+        // Every occurrence of a subexpression must have the same height, so
+        // each distinct subexpression only needs to be checked once.
+        std::unordered_map<const Expr*, int32_t> checked;
+        std::vector<std::pair<const Expr*, int32_t>> stack;
+        stack.push_back({this, height});
+        while (!stack.empty()) {
+            auto [expr, expr_height] = stack.back();
+            stack.pop_back();
 
-                new_expr = Expr::Not(new_left);
-                break;
+            auto [it, inserted] = checked.insert({expr, expr_height});
+            if (!inserted) {
+                assert(it->second == expr_height);
+                continue;
             }
-            case Expr::AND:
-            case Expr::OR:
-            case Expr::XOR: {
-                // Make both operands constant height.
-                int32_t left_height = left->height(var_heights);
-                const Expr* new_left = left->with_constant_height(left_height, var_heights);
-                int32_t right_height = right->height(var_heights);
-                const Expr* new_right = right->with_constant_height(right_height, var_heights);
-
-                // Make both operands the same height.
-                int32_t child_height = std::max(left_height, right_height);
-                new_left = new_left->pad_height(child_height - left_height);
-                new_right = new_right->pad_height(child_height - right_height);
 
-                switch (type) {
-                    case Expr::AND:
-                        new_expr = Expr::And(new_left, new_right);
-                        break;
-                    case Expr::OR:
-                        new_expr = Expr::Or(new_left, new_right);
-                        break;
-                    case Expr::XOR:
-                        new_expr = Expr::Xor(new_left, new_right);
-                        break;
-                    default:
-                        assert(false);
-                        break;
-                }
-                break;
+            switch (expr->type) {
+                case Expr::NOT:
+                    stack.push_back({expr->left, expr_height - 1});
+                    break;
+                case Expr::AND:
+                case Expr::OR:
+                case Expr::XOR:
+                    stack.push_back({expr->left, expr_height - 1});
+                    stack.push_back({expr->right, expr_height - 1});
+                    break;
+                default:
+                    assert(expr->type >= 0 && (size_t) expr->type < var_heights.size());
+                    assert(var_heights[expr->type] == expr_height);
             }
-            default:
-                // Variables are left as-is.
-                assert(0 <= type && (size_t) type < var_heights.size());
-                assert(var_heights[type] <= height);
-                new_expr = this;
         }
+    }
 
-        return new_expr->pad_height(height - new_expr->height(var_heights));
+    // Return an equivalent expression where the i'th variable is replaced with
+    // the var_map[i]'th variable.
+    const Expr* with_vars(const std::vector<int32_t> &var_map) const {
+        std::unordered_map<const Expr*, const Expr*> memo;
+        return with_vars(var_map, memo);
     }
 
-    void assert_constant_height(int32_t height, const std::vector<int32_t> &var_heights) const {
+    friend std::ostream& operator<< (std::ostream &out, const Expr &expr) {
+        expr.print(out, nullptr);
+        return out;
+    }
+
+    // Evaluate an expression on up to 64 inputs at once. The i'th element of
+    // vars holds the values of the i'th variable, where bit j is its value in
+    // input j. Bit j of the result is the value of the expression on input j.
+    // This walks the expression as a tree, without allocating, which suits
+    // one-off evaluations. To evaluate the same expression many times, use
+    // ExprEvaluator, which visits each distinct subexpression once.
+    uint64_t eval_bits(const std::vector<uint64_t> &vars) const {
         switch (type) {
-            case Expr::NOT:
-                left->assert_constant_height(height - 1, var_heights);
-                break;
             case Expr::AND:
+                return left->eval_bits(vars) & right->eval_bits(vars);
             case Expr::OR:
+                return left->eval_bits(vars) | right->eval_bits(vars);
             case Expr::XOR:
-                left->assert_constant_height(height - 1, var_heights);
-                right->assert_constant_height(height - 1, var_heights);
-                break;
+                return left->eval_bits(vars) ^ right->eval_bits(vars);
+            case Expr::NOT:
+                return ~left->eval_bits(vars);
             default:
-                assert(type >= 0 && (size_t) type < var_heights.size());
-                assert(var_heights[type] == height);
+                assert(type >= 0 && (size_t) type < vars.size());
+                return vars[type];
         }
     }
 
-    friend std::ostream& operator<< (std::ostream &out, const Expr &expr) {
-        expr.print(out, nullptr);
-        return out;
+    // Write the expression in a form that deserialize can read back, with
+    // shared subexpressions written once: the number of distinct
+    // subexpressions, then one line for each of them in postorder, which is
+    // either "v N" for the N'th variable, "! I" for NOT, or "& I J", "| I J",
+    // or "^ I J" for binary operators, where I and J are earlier lines.
+    void serialize(std::ostream &out) const {
+        std::vector<const Expr*> order = postorder();
+        std::unordered_map<const Expr*, size_t> lines;
+        out << order.size() << "\n";
+        for (const Expr* expr : order) {
+            switch (expr->type) {
+                case Expr::AND:
+                    out << "& " << lines[expr->left] << " " << lines[expr->right];
+                    break;
+                case Expr::OR:
+                    out << "| " << lines[expr->left] << " " << lines[expr->right];
+                    break;
+                case Expr::XOR:
+                    out << "^ " << lines[expr->left] << " " << lines[expr->right];
+                    break;
+                case Expr::NOT:
+                    out << "! " << lines[expr->left];
+                    break;
+                default:
+                    out << "v " << expr->type;
+                    break;
+            }
+            out << "\n";
+            size_t line = lines.size();
+            lines[expr] = line;
+        }
+    }
+
+    // Read an expression written by serialize, in the current arena. Returns
+    // nullptr if the input is malformed or uses a variable number that isn't
+    // less than num_vars.
+    static const Expr* deserialize(std::istream &in, uint32_t num_vars) {
+        size_t num_lines;
+        if (!(in >> num_lines) || num_lines == 0) {
+            return nullptr;
+        }
+
+        std::vector<const Expr*> lines;
+        for (size_t line = 0; line < num_lines; line++) {
+            char op;
+            if (!(in >> op)) {
+                return nullptr;
+            }
+
+            // Every operand must refer to an earlier line.
+            size_t operands[2];
+            int32_t num_operands = op == 'v' ? 0 : op == '!' ? 1 : 2;
+            for (int32_t i = 0; i < num_operands; i++) {
+                if (!(in >> operands[i]) || operands[i] >= line) {
+                    return nullptr;
+                }
+            }
+
+            switch (op) {
+                case 'v': {
+                    int32_t var;
+                    if (!(in >> var) || var < 0 || (uint32_t) var >= num_vars) {
+                        return nullptr;
+                    }
+                    lines.push_back(Expr::Var(var));
+                    break;
+                }
+                case '!':
+                    lines.push_back(Expr::Not(lines[operands[0]]));
+                    break;
+                case '&':
+                    lines.push_back(Expr::And(lines[operands[0]], lines[operands[1]]));
+                    break;
+                case '|':
+                    lines.push_back(Expr::Or(lines[operands[0]], lines[operands[1]]));
+                    break;
+                case '^':
+                    lines.push_back(Expr::Xor(lines[operands[0]], lines[operands[1]]));
+                    break;
+                default:
+                    return nullptr;
+            }
+        }
+
+        return lines.back();
     }
 
     // Evaluate an expression with the given variable values.
@@ -203,4 +446,167 @@ public:
     }
 };
 
+// An expression flattened into postorder once, so that it can be evaluated
+// many times, such as on every chunk of a truth table, without walking the
+// DAG or allocating again.
+class ExprEvaluator {
+private:
+    struct Step {
+        // As in Expr.
+        int32_t type;
+
+        // The steps computing the children, if present.
+        int32_t left;
+        int32_t right;
+    };
+
+    std::vector<Step> steps;
+
+    // The value of each step in the last evaluation.
+    std::vector<uint64_t> values;
+
+public:
+    explicit ExprEvaluator(const Expr* expr) {
+        std::vector<const Expr*> order = expr->postorder();
+        std::unordered_map<const Expr*, int32_t> positions;
+        for (const Expr* node : order) {
+            int32_t left = node->left != nullptr ? positions.at(node->left) : -1;
+            int32_t right = node->right != nullptr ? positions.at(node->right) : -1;
+            positions[node] = steps.size();
+            steps.push_back({node->type, left, right});
+        }
+        values.resize(steps.size());
+    }
+
+    // See Expr::eval_bits.
+    uint64_t eval_bits(const std::vector<uint64_t> &vars) {
+        for (size_t i = 0; i < steps.size(); i++) {
+            const Step &step = steps[i];
+            switch (step.type) {
+                case Expr::AND:
+                    values[i] = values[step.left] & values[step.right];
+                    break;
+                case Expr::OR:
+                    values[i] = values[step.left] | values[step.right];
+                    break;
+                case Expr::XOR:
+                    values[i] = values[step.left] ^ values[step.right];
+                    break;
+                case Expr::NOT:
+                    values[i] = ~values[step.left];
+                    break;
+                default:
+                    assert(step.type >= 0 && (size_t) step.type < vars.size());
+                    values[i] = vars[step.type];
+                    break;
+            }
+        }
+        return values.back();
+    }
+};
+
+// Owns expressions, and makes sure that there is only one copy of each
+// distinct expression. All expressions in an arena are freed together when the
+// arena is destroyed, so a long-running process can use one arena per job
+// instead of leaking every candidate solution.
+//
+// Arenas are thread safe. Expressions may refer to expressions in other
+// arenas, as long as those outlive them.
+class ExprArena {
+private:
+    struct Key {
+        int32_t type;
+        const Expr* left;
+        const Expr* right;
+
+        bool operator==(const Key &other) const {
+            return type == other.type && left == other.left && right == other.right;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &key) const {
+            size_t hash = std::hash<int32_t>()(key.type);
+            hash = hash * 31 + std::hash<const Expr*>()(key.left);
+            hash = hash * 31 + std::hash<const Expr*>()(key.right);
+            return hash;
+        }
+    };
+
+    // Number of expressions per chunk of storage.
+    static const size_t CHUNK_SIZE = 1024;
+
+    typedef std::aligned_storage_t<sizeof(Expr), alignof(Expr)> Slot;
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Slot[]>> chunks;
+    size_t num_exprs = 0;
+    std::unordered_map<Key, const Expr*, KeyHash> exprs;
+
+    static ExprArena*& current_pointer() {
+        static thread_local ExprArena* current = nullptr;
+        return current;
+    }
+
+public:
+    ExprArena() {}
+    ExprArena(const ExprArena&) = delete;
+    ExprArena& operator=(const ExprArena&) = delete;
+
+    // Return the existing expression with the given fields, or create one.
+    const Expr* intern(int32_t type, const Expr* left, const Expr* right) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        Key key = {type, left, right};
+        auto it = exprs.find(key);
+        if (it != exprs.end()) {
+            return it->second;
+        }
+
+        if (num_exprs % CHUNK_SIZE == 0) {
+            chunks.emplace_back(new Slot[CHUNK_SIZE]);
+        }
+        // Expr is trivially destructible, so the chunks can be freed without
+        // running destructors.
+        Expr* expr = new (&chunks.back()[num_exprs % CHUNK_SIZE]) Expr(type, left, right);
+        num_exprs++;
+
+        exprs[key] = expr;
+        return expr;
+    }
+
+    // Number of distinct expressions in the arena.
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return num_exprs;
+    }
+
+    // The arena used for new expressions on this thread: the innermost Scope,
+    // or a global arena that is never freed.
+    static ExprArena& current() {
+        static ExprArena global;
+        ExprArena* current = current_pointer();
+        return current == nullptr ? global : *current;
+    }
+
+    // Makes an arena current on this thread for the lifetime of the scope.
+    class Scope {
+    private:
+        ExprArena* previous;
+
+    public:
+        Scope(ExprArena &arena) : previous(current_pointer()) {
+            current_pointer() = &arena;
+        }
+
+        ~Scope() {
+            current_pointer() = previous;
+        }
+    };
+};
+
+inline const Expr* Expr::make(int32_t type, const Expr* left, const Expr* right) {
+    return ExprArena::current().intern(type, left, right);
+}
+
 #endif
@@ -0,0 +1,124 @@
+// Solve a spec through the C interface (see libsynth.h), as an embedding
+// program would.
+//
+// Usage: lib_example [file [timeout_ms]]
+//
+// With a file, its spec is parsed (in the SyGuS format if its name ends with
+// .sl), and synthesis is cancelled after timeout_ms, if given. Otherwise, the
+// 3-input majority function is solved.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libsynth.h"
+
+struct watchdog {
+    synth_cancel* cancel;
+    long timeout_ms;
+};
+
+static void* watch(void* arg) {
+    struct watchdog* watchdog = arg;
+    struct timespec delay = {watchdog->timeout_ms / 1000, (watchdog->timeout_ms % 1000) * 1000000};
+    nanosleep(&delay, NULL);
+    synth_cancel_request(watchdog->cancel);
+    return NULL;
+}
+
+static void print_log(void* user, const char* line) {
+    (void) user;
+    fprintf(stderr, "log: %s\n", line);
+}
+
+static void print_candidate(void* user, const char* expr) {
+    int* count = user;
+    printf("candidate %d: %s\n", ++*count, expr);
+}
+
+static char* read_file(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        exit(1);
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* text = malloc(size + 1);
+    if (fread(text, 1, size, file) != (size_t) size) {
+        perror(path);
+        exit(1);
+    }
+    text[size] = '\0';
+    fclose(file);
+    return text;
+}
+
+int main(int argc, char* argv[]) {
+    synth_spec* spec;
+    if (argc > 1) {
+        size_t length = strlen(argv[1]);
+        int sygus = length >= 3 && strcmp(argv[1] + length - 3, ".sl") == 0;
+        char* text = read_file(argv[1]);
+        spec = synth_spec_parse(text, sygus ? SYNTH_FORMAT_SYGUS : SYNTH_FORMAT_TRUTH_TABLE);
+        free(text);
+    } else {
+        const char* names[] = {"a", "b", "c"};
+        int32_t heights[] = {0, 0, 0};
+        uint8_t outputs[8];
+        for (int row = 0; row < 8; row++) {
+            outputs[row] = (row & 1) + ((row >> 1) & 1) + ((row >> 2) & 1) >= 2;
+        }
+        spec = synth_spec_new(3, names, heights, 3, outputs);
+    }
+    if (spec == NULL) {
+        fprintf(stderr, "%s\n", synth_last_error());
+        return 1;
+    }
+
+    int num_candidates = 0;
+    synth_config* config = synth_config_new();
+    synth_cancel* cancel = synth_cancel_new();
+    synth_config_set_log(config, print_log, NULL);
+    synth_config_set_candidate_callback(config, print_candidate, &num_candidates);
+    synth_config_set_cancel(config, cancel);
+
+    pthread_t watcher;
+    struct watchdog watchdog = {cancel, argc > 2 ? atol(argv[2]) : 0};
+    if (watchdog.timeout_ms > 0) {
+        pthread_create(&watcher, NULL, watch, &watchdog);
+    }
+
+    synth_result* result = synth_solve(spec, config);
+    switch (synth_result_status(result)) {
+    case SYNTH_SOLVED:
+        printf("solved in %d iteration(s), %llu ms: %s\n", synth_result_iterations(result),
+                (unsigned long long) synth_result_ms(result), synth_result_solution(result));
+        break;
+    case SYNTH_NO_SOLUTION:
+        printf("no solution\n");
+        break;
+    case SYNTH_CANCELLED:
+        printf("cancelled after %llu ms\n", (unsigned long long) synth_result_ms(result));
+        break;
+    case SYNTH_ERROR:
+        printf("error: %s\n", synth_result_message(result));
+        break;
+    case SYNTH_BUDGET_EXCEEDED:
+        printf("stopped after %llu ms: %s\n", (unsigned long long) synth_result_ms(result),
+                synth_result_message(result));
+        break;
+    }
+
+    if (watchdog.timeout_ms > 0) {
+        pthread_join(watcher, NULL);
+    }
+    synth_result_free(result);
+    synth_cancel_free(cancel);
+    synth_config_free(config);
+    synth_spec_free(spec);
+    return 0;
+}
@@ -0,0 +1,385 @@
+// Implementation of the C interface in libsynth.h, on top of cegis and the
+// synthesizer variant selected by SYNTH_VARIANT. See the Makefile for the
+// library targets.
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "cegis.hpp"
+#include "expr.hpp"
+#include "libsynth.h"
+#include "options.hpp"
+#include "parser.hpp"
+#include "progress.hpp"
+#include "spec.hpp"
+#include "timer.hpp"
+
+#ifndef SYNTH_VARIANT
+#error "SYNTH_VARIANT must be defined. See the Makefile."
+#elif SYNTH_VARIANT == 1
+#include "synth_cpu_st.hpp"
+#elif SYNTH_VARIANT == 2
+#include "synth_cpu_mt.hpp"
+#else
+#error "Unsupported SYNTH_VARIANT."
+#endif
+
+struct synth_spec {
+    Spec spec;
+};
+
+struct synth_cancel {
+    std::atomic<bool> requested{false};
+};
+
+struct synth_config {
+    Options options;
+
+    // Number of OpenMP threads, or 0 for the default.
+    int32_t threads = 0;
+
+    synth_log_fn log_fn = nullptr;
+    void* log_user = nullptr;
+    synth_candidate_fn candidate_fn = nullptr;
+    void* candidate_user = nullptr;
+    synth_progress_fn progress_fn = nullptr;
+    void* progress_user = nullptr;
+    synth_cancel* cancel = nullptr;
+};
+
+struct synth_result {
+    synth_status status = SYNTH_ERROR;
+    std::string solution;
+    std::string serialized;
+    std::string message;
+    int32_t iterations = 0;
+    uint64_t ms = 0;
+};
+
+namespace {
+
+thread_local std::string last_error;
+
+// Passes each line written to it to a log callback, or discards it if there
+// is no callback.
+class CallbackBuf : public std::streambuf {
+private:
+    synth_log_fn fn;
+    void* user;
+    std::string line;
+
+protected:
+    int overflow(int c) override {
+        if (c == traits_type::eof() || fn == nullptr) {
+            return traits_type::not_eof(c);
+        }
+        if (c == '\n') {
+            fn(user, line.c_str());
+            line.clear();
+        } else {
+            line += (char) c;
+        }
+        return c;
+    }
+
+public:
+    CallbackBuf(synth_log_fn fn, void* user) : fn(fn), user(user) {}
+};
+
+synth_spec* checked_spec(Spec spec) {
+    if (spec.num_vars == 0 || spec.num_vars > SPEC_MAX_VARS) {
+        last_error = "unsupported number of variables (" + std::to_string(spec.num_vars) + ")";
+        return nullptr;
+    }
+    return new synth_spec{spec};
+}
+
+}
+
+synth_spec* synth_spec_new(uint32_t num_vars, const char* const* names,
+        const int32_t* heights, int32_t sol_height, const uint8_t* outputs) {
+    if (num_vars == 0 || num_vars > SPEC_MAX_VARS) {
+        last_error = "unsupported number of variables (" + std::to_string(num_vars) + ")";
+        return nullptr;
+    }
+
+    try {
+        std::vector<std::string> var_names(names, names + num_vars);
+        std::vector<int32_t> var_heights(heights, heights + num_vars);
+        std::vector<std::vector<bool>> all_inputs;
+        std::vector<bool> all_sols;
+        for (uint64_t row = 0; row < (1ULL << num_vars); row++) {
+            std::vector<bool> inputs;
+            for (uint32_t var = 0; var < num_vars; var++) {
+                inputs.push_back((row >> var) & 1);
+            }
+            all_inputs.push_back(inputs);
+            all_sols.push_back(outputs[row] != 0);
+        }
+
+        return checked_spec(Spec(num_vars, 1, var_names, var_heights, sol_height,
+                    all_inputs, all_sols));
+    } catch (const std::exception &e) {
+        last_error = std::string("can't create spec: ") + e.what();
+        return nullptr;
+    }
+}
+
+synth_spec* synth_spec_parse(const char* text, synth_format format) {
+    try {
+        std::istringstream in(text);
+        return checked_spec(format == SYNTH_FORMAT_SYGUS
+                ? Parser::parseInput(in) : Parser::parseTruthTableInput(in));
+    } catch (const std::exception &e) {
+        last_error = std::string("can't parse spec: ") + e.what();
+        return nullptr;
+    }
+}
+
+uint32_t synth_spec_num_vars(const synth_spec* spec) {
+    return spec->spec.num_vars;
+}
+
+void synth_spec_free(synth_spec* spec) {
+    delete spec;
+}
+
+const char* synth_last_error(void) {
+    return last_error.c_str();
+}
+
+synth_config* synth_config_new(void) {
+    return new synth_config();
+}
+
+int synth_config_set(synth_config* config, const char* key, const char* value) {
+    try {
+        if (std::string(key) == "threads") {
+            config->threads = std::stoi(value);
+            return 0;
+        }
+        if (!config->options.parse(std::string("--") + key + "=" + value)) {
+            return -1;
+        }
+    } catch (const std::exception&) {
+        return -1;
+    }
+
+    // Shards are forked processes, which is only safe while no other thread
+    // is running (see synth_cpu_mt.hpp).
+    if (config->options.shards > 1) {
+        config->options.shards = 1;
+        last_error = "shards aren't supported in a library";
+        return -1;
+    }
+
+    // These are global (see libsynth.h).
+    if (std::string(key) == "pages" || std::string(key) == "prefault") {
+        set_alloc_policy(config->options.alloc_policy);
+    }
+    return 0;
+}
+
+void synth_config_set_log(synth_config* config, synth_log_fn fn, void* user) {
+    config->log_fn = fn;
+    config->log_user = user;
+}
+
+void synth_config_set_candidate_callback(synth_config* config,
+        synth_candidate_fn fn, void* user) {
+    config->candidate_fn = fn;
+    config->candidate_user = user;
+}
+
+void synth_config_set_progress_callback(synth_config* config,
+        synth_progress_fn fn, void* user) {
+    config->progress_fn = fn;
+    config->progress_user = user;
+}
+
+void synth_config_set_cancel(synth_config* config, synth_cancel* cancel) {
+    config->cancel = cancel;
+}
+
+void synth_config_free(synth_config* config) {
+    delete config;
+}
+
+synth_cancel* synth_cancel_new(void) {
+    return new synth_cancel();
+}
+
+void synth_cancel_request(synth_cancel* cancel) {
+    cancel->requested = true;
+}
+
+void synth_cancel_reset(synth_cancel* cancel) {
+    cancel->requested = false;
+}
+
+void synth_cancel_free(synth_cancel* cancel) {
+    delete cancel;
+}
+
+struct synth_job {
+    // cegis changes the spec's examples, and the config may be changed or
+    // freed while the job runs, so both are copied.
+    Spec spec;
+    synth_config config;
+
+    CallbackBuf log_buf;
+    std::ostream log;
+    Options options;
+
+    // Expressions are freed with the job, once they have been printed to the
+    // result.
+    ExprArena arena;
+
+    // Created by the first step.
+    std::unique_ptr<Cegis<Synthesizer>> cegis;
+
+    bool done = false;
+    synth_result result;
+
+    synth_job(const Spec &spec, const synth_config &config) :
+            spec(spec),
+            config(config),
+            log_buf(config.log_fn, config.log_user),
+            log(&log_buf),
+            options(config.options) {
+        options.log = &log;
+        if (config.cancel != nullptr) {
+            options.cancel = &config.cancel->requested;
+        }
+        if (config.candidate_fn != nullptr) {
+            options.on_candidate = [this](const Expr* expr) {
+                std::ostringstream text;
+                expr->print(text, &this->spec.var_names);
+                this->config.candidate_fn(this->config.candidate_user, text.str().c_str());
+            };
+        }
+        if (config.progress_fn != nullptr) {
+            if (options.progress_ms == 0) {
+                options.progress_ms = 1000;
+            }
+            options.on_progress = [this](const Progress &progress) {
+                synth_progress sample = {progress.height, progress.pass, progress.tiles_done,
+                    progress.num_tiles, progress.new_terms, progress.num_terms,
+                    progress.elapsed_ms, progress.terms_per_second, progress.pass_eta_ms,
+                    progress.height_eta_ms};
+                this->config.progress_fn(this->config.progress_user, &sample);
+            };
+        }
+    }
+
+    void finish(const Expr* expr) {
+        done = true;
+        if (expr != nullptr) {
+            std::ostringstream solution, serialized;
+            expr->print(solution, &spec.var_names);
+            expr->serialize(serialized);
+            result.status = SYNTH_SOLVED;
+            result.solution = solution.str();
+            result.serialized = serialized.str();
+        } else if (options.cancel != nullptr && *options.cancel) {
+            result.status = SYNTH_CANCELLED;
+        } else if (cegis->budget_status().exceeded()) {
+            std::ostringstream message;
+            cegis->budget_status().print(message);
+            result.status = SYNTH_BUDGET_EXCEEDED;
+            result.message = message.str();
+        } else {
+            result.status = SYNTH_NO_SOLUTION;
+        }
+        result.iterations = cegis->num_iterations();
+        cegis.reset();
+    }
+};
+
+synth_result* synth_solve(const synth_spec* spec, const synth_config* config) {
+    synth_job* job = synth_job_new(spec, config);
+    while (!synth_job_step(job, INT64_MAX)) {}
+    synth_result* result = synth_job_result(job);
+    synth_job_free(job);
+    return result;
+}
+
+synth_job* synth_job_new(const synth_spec* spec, const synth_config* config) {
+    return new synth_job(spec->spec, *config);
+}
+
+int synth_job_step(synth_job* job, int64_t max_tiles) {
+    if (job->done) {
+        return 1;
+    }
+#ifdef _OPENMP
+    if (job->config.threads > 0) {
+        omp_set_num_threads(job->config.threads);
+    }
+#endif
+
+    ExprArena::Scope scope(job->arena);
+    Timer timer;
+    try {
+        if (job->cegis == nullptr) {
+            job->cegis = std::make_unique<Cegis<Synthesizer>>(job->spec, &job->log, job->options);
+        }
+        if (job->cegis->step(max_tiles)) {
+            job->finish(job->cegis->solution());
+        }
+    } catch (const std::exception &e) {
+        job->done = true;
+        job->cegis.reset();
+        job->result.status = SYNTH_ERROR;
+        job->result.message = e.what();
+    }
+    job->result.ms += timer.ms();
+    return job->done;
+}
+
+synth_result* synth_job_result(const synth_job* job) {
+    return job->done ? new synth_result(job->result) : nullptr;
+}
+
+void synth_job_free(synth_job* job) {
+    delete job;
+}
+
+synth_status synth_result_status(const synth_result* result) {
+    return result->status;
+}
+
+const char* synth_result_solution(const synth_result* result) {
+    return result->status == SYNTH_SOLVED ? result->solution.c_str() : nullptr;
+}
+
+const char* synth_result_serialized(const synth_result* result) {
+    return result->status == SYNTH_SOLVED ? result->serialized.c_str() : nullptr;
+}
+
+int32_t synth_result_iterations(const synth_result* result) {
+    return result->iterations;
+}
+
+uint64_t synth_result_ms(const synth_result* result) {
+    return result->ms;
+}
+
+const char* synth_result_message(const synth_result* result) {
+    return result->message.c_str();
+}
+
+void synth_result_free(synth_result* result) {
+    delete result;
+}
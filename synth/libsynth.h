@@ -0,0 +1,195 @@
+// C interface to the synthesizer, for programs that run it in-process (see
+// libsynth.cpp). Build libsynth_cpu_st or libsynth_cpu_mt, as a static (.a)
+// or shared (.so) library, and link against it. Programs written in C must
+// also link the C++ runtime, and OpenMP for the multi-threaded variant.
+//
+// Typical use:
+//
+//   synth_spec* spec = synth_spec_new(num_vars, names, heights, sol_height, outputs);
+//   synth_config* config = synth_config_new();
+//   synth_config_set(config, "cache-dir", "/tmp/cache");
+//   synth_result* result = synth_solve(spec, config);
+//   if (synth_result_status(result) == SYNTH_SOLVED) {
+//       puts(synth_result_solution(result));
+//   }
+//   synth_result_free(result);
+//   synth_config_free(config);
+//   synth_spec_free(spec);
+//
+// Or, to interleave several specs on one thread, start a job for each, and
+// call synth_job_step on each in turn until it returns 1:
+//
+//   synth_job* job = synth_job_new(spec, config);
+//   while (!synth_job_step(job, 1000)) {
+//       // Other work.
+//   }
+//   synth_result* result = synth_job_result(job);
+//   synth_job_free(job);
+//
+// Every object is owned by the caller, and freed with its own function.
+// Strings returned by the library belong to the object they came from, and
+// stay valid until it is freed. Specs and configs may be shared by concurrent
+// calls to synth_solve, as long as they aren't modified.
+
+#ifndef LIBSYNTH_H
+#define LIBSYNTH_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SYNTH_API __attribute__((visibility("default")))
+
+typedef struct synth_spec synth_spec;
+typedef struct synth_config synth_config;
+typedef struct synth_cancel synth_cancel;
+typedef struct synth_result synth_result;
+typedef struct synth_job synth_job;
+
+typedef enum {
+    // A solution was found.
+    SYNTH_SOLVED,
+    // There is no solution with the spec's height.
+    SYNTH_NO_SOLUTION,
+    // Stopped by synth_cancel_request.
+    SYNTH_CANCELLED,
+    // The spec or config is invalid; see synth_result_message.
+    SYNTH_ERROR,
+    // Stopped by a budget set in the config, e.g. "time-limit-ms"; see
+    // synth_result_message for which, and how far synthesis got.
+    SYNTH_BUDGET_EXCEEDED,
+} synth_status;
+
+typedef enum {
+    SYNTH_FORMAT_SYGUS,
+    SYNTH_FORMAT_TRUTH_TABLE,
+} synth_format;
+
+// Called with each line of progress, without its newline.
+typedef void (*synth_log_fn)(void* user, const char* line);
+
+// Called with every candidate solution, including the final one.
+typedef void (*synth_candidate_fn)(void* user, const char* expr);
+
+// A sample of the pass in progress (see progress.hpp).
+typedef struct {
+    int32_t height;
+    const char* pass;
+    // Tiles done so far, out of num_tiles, or 0 of 0 if the pass isn't
+    // divided into tiles.
+    int64_t tiles_done;
+    int64_t num_tiles;
+    int64_t new_terms;
+    int64_t num_terms;
+    uint64_t elapsed_ms;
+    double terms_per_second;
+    // Projected time until the pass, and every pass of its height, are done,
+    // or -1 if unknown.
+    int64_t pass_eta_ms;
+    int64_t height_eta_ms;
+} synth_progress;
+
+// Called periodically while a pass runs.
+typedef void (*synth_progress_fn)(void* user, const synth_progress* progress);
+
+// Return a spec with a full truth table: outputs[i] is the output of the row
+// where variable j is bit j of i, so it has 2^num_vars entries. heights[j] is
+// the height of variable j. Returns NULL, and sets synth_last_error, if the
+// arguments are invalid or memory runs out.
+SYNTH_API synth_spec* synth_spec_new(uint32_t num_vars, const char* const* names,
+        const int32_t* heights, int32_t sol_height, const uint8_t* outputs);
+
+// Return a spec parsed from text in the given format, the same as an input
+// file. Returns NULL, and sets synth_last_error, if it can't be parsed.
+SYNTH_API synth_spec* synth_spec_parse(const char* text, synth_format format);
+
+SYNTH_API uint32_t synth_spec_num_vars(const synth_spec* spec);
+SYNTH_API void synth_spec_free(synth_spec* spec);
+
+// The reason for the last failure on this thread.
+SYNTH_API const char* synth_last_error(void);
+
+// Return a config with the default settings, and progress discarded.
+SYNTH_API synth_config* synth_config_new(void);
+
+// Set an option, with the same keys and values as the command line options
+// without their leading dashes, e.g. "cache-dir". "threads" sets the number
+// of threads of the multi-threaded variant. "shards" isn't supported. Returns
+// 0 on success, or -1 if the option is unknown or unsupported.
+//
+// "pages" and "prefault" aren't part of the config: memory is pooled by the
+// whole process, so they set how memory is allocated for every job in the
+// process, whatever config it uses. Set them once, before any job starts.
+SYNTH_API int synth_config_set(synth_config* config, const char* key, const char* value);
+
+// Callbacks are called on the thread running synth_solve, except for progress
+// (see below).
+SYNTH_API void synth_config_set_log(synth_config* config, synth_log_fn fn, void* user);
+SYNTH_API void synth_config_set_candidate_callback(synth_config* config,
+        synth_candidate_fn fn, void* user);
+
+// Report progress every "progress-ms", or every second if that isn't set.
+// The progress callback, and the log callback with progress lines, are called
+// from a reporter thread while a pass runs, but never at the same time as
+// other callbacks of the same solve. The pass waits for them to return.
+SYNTH_API void synth_config_set_progress_callback(synth_config* config,
+        synth_progress_fn fn, void* user);
+
+// Stop synth_solve calls using this config when cancel is requested.
+SYNTH_API void synth_config_set_cancel(synth_config* config, synth_cancel* cancel);
+
+SYNTH_API void synth_config_free(synth_config* config);
+
+// A cancellation handle. synth_cancel_request may be called from any thread,
+// and synth_solve calls using it return SYNTH_CANCELLED soon after. The
+// handle must outlive those calls.
+SYNTH_API synth_cancel* synth_cancel_new(void);
+SYNTH_API void synth_cancel_request(synth_cancel* cancel);
+SYNTH_API void synth_cancel_reset(synth_cancel* cancel);
+SYNTH_API void synth_cancel_free(synth_cancel* cancel);
+
+// Solve spec, on the calling thread. Never returns NULL.
+SYNTH_API synth_result* synth_solve(const synth_spec* spec, const synth_config* config);
+
+// Start solving spec, without doing any work yet. The job keeps its own copy
+// of the spec and config, but not of the cancel handle.
+SYNTH_API synth_job* synth_job_new(const synth_spec* spec, const synth_config* config);
+
+// Do at most max_tiles tiles of work on the job, on the calling thread, and
+// return 1 once it is done, or 0 if there is more to do. A tile is a fixed
+// amount of work, so the time a call takes is roughly proportional to
+// max_tiles; every pass but the binary ones counts as a whole tile. Steps of
+// one job may run on different threads, but not at the same time. Callbacks
+// are called from within steps.
+SYNTH_API int synth_job_step(synth_job* job, int64_t max_tiles);
+
+// Return the result of a job which is done, or NULL if it isn't. The result is
+// owned by the caller, and its time is the time spent in steps.
+SYNTH_API synth_result* synth_job_result(const synth_job* job);
+
+SYNTH_API void synth_job_free(synth_job* job);
+
+SYNTH_API synth_status synth_result_status(const synth_result* result);
+
+// The solution, with the spec's variable names, or NULL if not solved.
+SYNTH_API const char* synth_result_solution(const synth_result* result);
+
+// The solution in the format of Expr::serialize, or NULL if not solved.
+SYNTH_API const char* synth_result_serialized(const synth_result* result);
+
+SYNTH_API int32_t synth_result_iterations(const synth_result* result);
+SYNTH_API uint64_t synth_result_ms(const synth_result* result);
+
+// A description of the error or of the exceeded budget, or "" unless the
+// status is SYNTH_ERROR or SYNTH_BUDGET_EXCEEDED.
+SYNTH_API const char* synth_result_message(const synth_result* result);
+
+SYNTH_API void synth_result_free(synth_result* result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
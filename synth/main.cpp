@@ -2,6 +2,7 @@
 #include <string>
 #include <vector>
 
+#include "options.hpp"
 #include "spec.hpp"
 
 #ifndef SYNTH_VARIANT
@@ -19,9 +20,18 @@
 #error "Unsupported SYNTH_VARIANT."
 #endif
 
-int main(void) {
+int main(int argc, char *argv[]) {
     std::cerr << "Synthesizer variant: " << VARIANT_DESCRIPTION << std::endl;
 
+    Options options;
+    for (int arg = 1; arg < argc; arg++) {
+        if (!options.parse(argv[arg])) {
+            std::cerr << "Unknown argument: " << argv[arg] << std::endl;
+            return 1;
+        }
+    }
+    set_alloc_policy(options.alloc_policy);
+
     /*
     Spec spec(
         4,
@@ -94,11 +104,15 @@ int main(void) {
         std::vector<bool>(0)
     );
 
-    Synthesizer synthesizer(spec);
+    Synthesizer synthesizer(spec, options);
 
     const Expr* solution = synthesizer.synthesize();
 
-    if (solution == nullptr) {
+    if (solution == nullptr && synthesizer.budget_status().exceeded()) {
+        std::cout << "no solution: ";
+        synthesizer.budget_status().print(std::cout);
+        std::cout << std::endl;
+    } else if (solution == nullptr) {
         std::cout << "no solution" << std::endl;
     } else {
         std::cout << "solution: ";
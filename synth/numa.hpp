@@ -0,0 +1,305 @@
+// Placement of threads and memory on machines with several NUMA nodes.
+//
+// The topology is read from sysfs, and memory policies are set with raw system
+// calls, so that libnuma isn't needed. On machines with one node, or where
+// this information isn't available, everything here does nothing.
+
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "options.hpp"
+#include "util.hpp"
+
+class NumaTopology {
+private:
+    // The CPUs of each node.
+    std::vector<std::vector<int32_t>> node_cpus;
+
+    // Parse a sysfs CPU list, e.g. "0-3,8-11".
+    static std::vector<int32_t> parse_cpu_list(const std::string &list) {
+        std::vector<int32_t> cpus;
+        std::istringstream in(list);
+        std::string range;
+        while (std::getline(in, range, ',')) {
+            size_t dash = range.find('-');
+            int32_t first = std::stoi(range.substr(0, dash));
+            int32_t last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int32_t cpu = first; cpu <= last; cpu++) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    NumaTopology() {
+        for (int32_t node = 0; ; node++) {
+            std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            std::string list;
+            if (!in || !std::getline(in, list)) {
+                break;
+            }
+            node_cpus.push_back(list.empty() ? std::vector<int32_t>() : parse_cpu_list(list));
+        }
+
+        if (node_cpus.empty()) {
+            std::vector<int32_t> cpus;
+            for (int32_t cpu = 0; cpu < sysconf(_SC_NPROCESSORS_ONLN); cpu++) {
+                cpus.push_back(cpu);
+            }
+            node_cpus.push_back(cpus);
+        }
+    }
+
+public:
+    static const NumaTopology& get() {
+        static NumaTopology topology;
+        return topology;
+    }
+
+    int32_t num_nodes() const {
+        return node_cpus.size();
+    }
+
+    const std::vector<int32_t>& cpus(int32_t node) const {
+        return node_cpus[node];
+    }
+
+    // Return the node of the given CPU, or -1 if it is unknown.
+    int32_t node_of_cpu(int32_t cpu) const {
+        for (int32_t node = 0; node < num_nodes(); node++) {
+            for (int32_t node_cpu : node_cpus[node]) {
+                if (node_cpu == cpu) {
+                    return node;
+                }
+            }
+        }
+        return -1;
+    }
+
+    // Return the CPU that the given thread should be pinned to. Compact fills
+    // one node before the next, so that few threads share memory across
+    // nodes, while Scatter alternates between nodes, so that every node's
+    // memory bandwidth is used.
+    int32_t cpu_for_thread(int32_t thread, Affinity affinity) const {
+        std::vector<int32_t> order;
+        if (affinity == Affinity::Compact) {
+            for (auto &cpus : node_cpus) {
+                order.insert(order.end(), cpus.begin(), cpus.end());
+            }
+        } else {
+            for (size_t i = 0; order.size() < total_cpus(); i++) {
+                for (auto &cpus : node_cpus) {
+                    if (i < cpus.size()) {
+                        order.push_back(cpus[i]);
+                    }
+                }
+            }
+        }
+        return order.empty() ? -1 : order[thread % order.size()];
+    }
+
+    size_t total_cpus() const {
+        size_t count = 0;
+        for (auto &cpus : node_cpus) {
+            count += cpus.size();
+        }
+        return count;
+    }
+};
+
+// The CPUs that a thread may run on, saved before it is pinned, so that they
+// can be restored once the synthesizer that pinned it is done.
+class ThreadAffinity {
+private:
+#ifdef __linux__
+    cpu_set_t set;
+#endif
+    bool valid;
+
+public:
+    ThreadAffinity() : valid(false) {}
+
+    // The affinity of the calling thread.
+    static ThreadAffinity current() {
+        ThreadAffinity affinity;
+#ifdef __linux__
+        affinity.valid = sched_getaffinity(0, sizeof(affinity.set), &affinity.set) == 0;
+#endif
+        return affinity;
+    }
+
+    // Apply this affinity to the calling thread.
+    void restore() const {
+#ifdef __linux__
+        if (valid) {
+            sched_setaffinity(0, sizeof(set), &set);
+        }
+#endif
+    }
+};
+
+// Whether a synthesizer in this process has pinned its threads.
+std::atomic<bool>& numa_pinning_claimed() {
+    static std::atomic<bool> claimed(false);
+    return claimed;
+}
+
+// Claim the right to pin threads, for one synthesizer at a time, until it
+// calls numa_release_pinning. Jobs that run concurrently in one process, as
+// with --batch, the server, or libsynth, would otherwise pin their threads to
+// the same CPUs, so only the first of them pins its threads.
+bool numa_claim_pinning() {
+    return !numa_pinning_claimed().exchange(true);
+}
+
+void numa_release_pinning() {
+    numa_pinning_claimed().store(false);
+}
+
+// Pin the calling thread to the CPU that affinity places the given thread
+// number on, and return the node of that CPU, or -1 if it isn't pinned.
+int32_t numa_pin_thread(int32_t thread, Affinity affinity) {
+#ifdef __linux__
+    if (affinity == Affinity::None) {
+        return -1;
+    }
+    const NumaTopology &topology = NumaTopology::get();
+    int32_t cpu = topology.cpu_for_thread(thread, affinity);
+    if (cpu == -1) {
+        return -1;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        return -1;
+    }
+    return topology.node_of_cpu(cpu);
+#else
+    return -1;
+#endif
+}
+
+// Spread the pages of the given memory across all nodes, round robin,
+// moving any that are already placed. Random accesses to it are then spread
+// evenly across the nodes' memory controllers.
+void numa_interleave(void* ptr, size_t size) {
+#ifdef __linux__
+    const NumaTopology &topology = NumaTopology::get();
+    if (topology.num_nodes() < 2 || size == 0) {
+        return;
+    }
+
+    std::vector<unsigned long> mask(CEIL_DIV(topology.num_nodes(), 8 * sizeof(unsigned long)));
+    for (int32_t node = 0; node < topology.num_nodes(); node++) {
+        mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    }
+
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t) ptr & ~(page_size - 1);
+    size_t length = (uintptr_t) ptr + size - start;
+    if (syscall(SYS_mbind, start, length, MPOL_INTERLEAVE, mask.data(),
+                topology.num_nodes() + 1, MPOL_MF_MOVE) != 0) {
+        std::perror("mbind");
+    }
+#endif
+}
+
+// Drop the pages of the given memory, so that each page is placed on the node
+// of the thread that writes it first. Only for private anonymous memory whose
+// contents don't matter: the pages of shared or file-backed memory are kept
+// by the kernel, so they would stay where they are.
+void numa_first_touch(void* ptr, size_t size) {
+#ifdef __linux__
+    if (NumaTopology::get().num_nodes() < 2 || size == 0) {
+        return;
+    }
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = CEIL_DIV((uintptr_t) ptr, page_size) * page_size;
+    uintptr_t end = ((uintptr_t) ptr + size) & ~(page_size - 1);
+    if (end > start) {
+        madvise((void*) start, end - start, MADV_DONTNEED);
+    }
+#endif
+}
+
+// Return the number of pages of the given memory on each node, sampling at
+// most max_samples pages. Pages that haven't been touched aren't counted.
+std::vector<uint64_t> numa_pages_per_node(const void* ptr, size_t size, size_t max_samples) {
+    const NumaTopology &topology = NumaTopology::get();
+    std::vector<uint64_t> counts(topology.num_nodes(), 0);
+#ifdef __linux__
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t) ptr & ~(page_size - 1);
+    size_t num_pages = CEIL_DIV((uintptr_t) ptr + size - start, page_size);
+    size_t stride = std::max((size_t) 1, num_pages / std::max(max_samples, (size_t) 1));
+
+    std::vector<void*> pages;
+    for (size_t page = 0; page < num_pages; page += stride) {
+        pages.push_back((void*) (start + page * page_size));
+    }
+    std::vector<int> status(pages.size());
+    if (pages.empty() || syscall(SYS_move_pages, 0, pages.size(), pages.data(),
+                nullptr, status.data(), 0) != 0) {
+        return counts;
+    }
+    for (int node : status) {
+        if (node >= 0 && node < topology.num_nodes()) {
+            counts[node] += stride;
+        }
+    }
+#endif
+    return counts;
+}
+
+// Write where the given memory is placed, by node, to log. If the nodes of
+// the threads accessing it are given, also estimate the fraction of their
+// accesses that go to another node, assuming that accesses are uniformly
+// random, which is the case for the seen bitset.
+void numa_report_placement(std::ostream &log, const std::string &name, const void* ptr,
+        size_t size, const std::vector<int32_t> &thread_nodes) {
+    std::vector<uint64_t> pages = numa_pages_per_node(ptr, size, 4096);
+    uint64_t total = 0;
+    for (uint64_t count : pages) {
+        total += count;
+    }
+    if (total == 0) {
+        return;
+    }
+
+    log << "\tnuma: " << name << ":";
+    for (size_t node = 0; node < pages.size(); node++) {
+        log << " node " << node << " " << 100 * pages[node] / total << "%";
+    }
+
+    if (!thread_nodes.empty()) {
+        double remote = 0;
+        for (int32_t node : thread_nodes) {
+            remote += node == -1 ? 0 : 1 - (double) pages[node] / total;
+        }
+        log << ", ~" << (int32_t) (100 * remote / thread_nodes.size())
+            << "% of accesses remote";
+    }
+    log << std::endl;
+}
+
+#endif
@@ -0,0 +1,283 @@
+// Compact storage for the operands of the terms added in one pass.
+
+#ifndef OPERANDS_H
+#define OPERANDS_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "alloc.hpp"
+
+// Every pass adds a contiguous range of terms to the bank, and the operands of
+// those terms lie in a range that is known when the pass starts (for example,
+// the right operand of an AND always has height `height - 1`). Instead of
+// storing every operand as a full bank index, we store the offset from the
+// start of that range, using the narrowest integer type that fits. Unary terms
+// have no right operand, so they get no storage for one.
+//
+// The left operand of a binary term can be any term of a lower height, so its
+// range starts at 0, and it only fits in fewer than 32 bits while the bank
+// has at most 2^16 terms. On larger banks, the saving comes from the right
+// operands, whose range is one height, and from unary and check passes.
+class TermOperands {
+public:
+    // How operands are stored, as recorded in bank files.
+    struct Layout {
+        uint32_t left_base;
+        uint32_t right_base;
+        int32_t left_width;
+        int32_t right_width;
+    };
+
+private:
+    // Maximum number of terms that the pass can add.
+    int64_t capacity;
+
+    // Subtracted from every operand before it is stored.
+    uint32_t left_base;
+    uint32_t right_base;
+
+    // Bytes per stored operand (1, 2, or 4), or 0 if there is no operand.
+    int32_t left_width;
+    int32_t right_width;
+
+    uint8_t* lefts;
+    uint8_t* rights;
+
+    static uint8_t* alloc_operands(int64_t capacity, int32_t width,
+            const std::string &spill_dir, bool shared) {
+        if (capacity == 0 || width == 0) {
+            return nullptr;
+        }
+        // The capacity is the most terms the pass could add, which few passes
+        // come near, so the storage isn't prefaulted.
+        return (uint8_t*) alloc_spilled(capacity * width, spill_dir, shared, false);
+    }
+
+    static uint32_t load(const uint8_t* values, int32_t width, int64_t pos) {
+        switch (width) {
+            case 1:
+                return values[pos];
+            case 2: {
+                uint16_t value;
+                memcpy(&value, &values[pos * 2], 2);
+                return value;
+            }
+            case 4: {
+                uint32_t value;
+                memcpy(&value, &values[pos * 4], 4);
+                return value;
+            }
+        }
+        assert(false);
+        return 0;
+    }
+
+    template <typename T, typename Index>
+    static void store_all_as(uint8_t* values, int64_t pos, int64_t count,
+            const Index* operands, uint32_t base) {
+        T* dest = (T*) values + pos;
+        for (int64_t i = 0; i < count; i++) {
+            dest[i] = operands[i] - base;
+        }
+    }
+
+    // Store count operands, starting at the given position.
+    template <typename Index>
+    static void store_all(uint8_t* values, int32_t width, int64_t pos,
+            int64_t count, const Index* operands, uint32_t base) {
+        switch (width) {
+            case 1:
+                store_all_as<uint8_t>(values, pos, count, operands, base);
+                break;
+            case 2:
+                store_all_as<uint16_t>(values, pos, count, operands, base);
+                break;
+            case 4:
+                store_all_as<uint32_t>(values, pos, count, operands, base);
+                break;
+            default:
+                assert(false);
+        }
+    }
+
+public:
+    // Return the number of bytes needed to store values up to max_value.
+    static int32_t width_for(uint64_t max_value) {
+        if (max_value <= UINT8_MAX) {
+            return 1;
+        }
+        if (max_value <= UINT16_MAX) {
+            return 2;
+        }
+        return 4;
+    }
+
+    // Left operands will be in [left_base, left_end), and right operands in
+    // [right_base, right_end). If right_end is equal to right_base, the terms
+    // have no right operand. If narrow is false, operands are stored as full
+    // uint32_t bank indices, which is what the GPU kernels write. Storage is
+    // allocated with alloc_spilled.
+    TermOperands(int64_t capacity, uint32_t left_base, uint64_t left_end,
+            uint32_t right_base, uint64_t right_end, bool narrow,
+            const std::string &spill_dir, bool shared) :
+        capacity(capacity),
+        left_base(narrow ? left_base : 0),
+        right_base(narrow ? right_base : 0),
+        left_width(narrow ? width_for(left_end - left_base - 1) : 4),
+        right_width(right_end == right_base ? 0
+                : narrow ? width_for(right_end - right_base - 1) : 4) {
+        assert(left_end > left_base || capacity == 0);
+        lefts = alloc_operands(capacity, left_width, spill_dir, shared);
+        rights = alloc_operands(capacity, right_width, spill_dir, shared);
+    }
+
+    // Allocate storage for capacity terms with the given layout, for
+    // restoring a pass from a bank file.
+    TermOperands(int64_t capacity, const Layout &layout, const std::string &spill_dir,
+            bool shared) :
+        capacity(capacity),
+        left_base(layout.left_base),
+        right_base(layout.right_base),
+        left_width(layout.left_width),
+        right_width(layout.right_width) {
+        lefts = alloc_operands(capacity, left_width, spill_dir, shared);
+        rights = alloc_operands(capacity, right_width, spill_dir, shared);
+    }
+
+    // Owned by AbstractSynthesizer, which frees the storage explicitly.
+    void release() {
+        if (lefts != nullptr) {
+            dealloc(lefts, capacity * left_width);
+        }
+        if (rights != nullptr) {
+            dealloc(rights, capacity * right_width);
+        }
+        lefts = nullptr;
+        rights = nullptr;
+    }
+
+    // Return whether count operands stored with the given width and base,
+    // such as those read from a bank file, are all below end. Trivially true
+    // if there are no operands (width is 0).
+    static bool all_below(const uint8_t* values, int32_t width, uint32_t base,
+            int64_t count, uint64_t end) {
+        if (width == 0) {
+            return true;
+        }
+        for (int64_t i = 0; i < count; i++) {
+            if ((uint64_t) base + load(values, width, i) >= end) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    Layout layout() const {
+        return {left_base, right_base, left_width, right_width};
+    }
+
+    // The stored operands of the first count terms, and their size in bytes.
+    uint8_t* left_data() {
+        return lefts;
+    }
+
+    uint8_t* right_data() {
+        return rights;
+    }
+
+    size_t left_bytes(int64_t count) const {
+        return count * left_width;
+    }
+
+    size_t right_bytes(int64_t count) const {
+        return count * right_width;
+    }
+
+    // The operands are only needed again to reconstruct the solution, so
+    // spilled storage can be written back once the pass is done.
+    void advise_done() {
+        advise(lefts, capacity * left_width, Access::Cold);
+        advise(rights, capacity * right_width, Access::Cold);
+    }
+
+    bool has_right() const {
+        return right_width != 0;
+    }
+
+    // Bytes of storage used per term.
+    int32_t bytes_per_term() const {
+        return left_width + right_width;
+    }
+
+    // The left operands, for kernels that write them directly, as offsets
+    // from layout().left_base. T must match layout().left_width.
+    template <typename T>
+    T* lefts_as() {
+        assert(sizeof(T) == (size_t) left_width);
+        return (T*) lefts;
+    }
+
+    // Set the right operand of count terms, starting at the given position in
+    // the pass, to right.
+    void fill_rights(int64_t pos, int64_t count, uint32_t right) {
+        assert(0 <= pos && pos + count <= capacity && has_right());
+        switch (right_width) {
+            case 1:
+                std::fill_n(rights + pos, count, (uint8_t) (right - right_base));
+                break;
+            case 2:
+                std::fill_n((uint16_t*) rights + pos, count, (uint16_t) (right - right_base));
+                break;
+            case 4:
+                std::fill_n((uint32_t*) rights + pos, count, right - right_base);
+                break;
+            default:
+                assert(false);
+        }
+    }
+
+    // The raw storage, for kernels that write operands directly. Only valid
+    // if narrow was false.
+    uint32_t* wide_lefts() {
+        assert(left_width == 4 && left_base == 0);
+        return (uint32_t*) lefts;
+    }
+
+    uint32_t* wide_rights() {
+        assert(right_width == 4 && right_base == 0);
+        return (uint32_t*) rights;
+    }
+
+    // Return the operands of the term at the given position in the pass.
+    uint32_t left(int64_t pos) const {
+        assert(0 <= pos && pos < capacity);
+        return left_base + load(lefts, left_width, pos);
+    }
+
+    uint32_t right(int64_t pos) const {
+        assert(0 <= pos && pos < capacity && has_right());
+        return right_base + load(rights, right_width, pos);
+    }
+
+    // Set the operands of count terms, starting at the given position in the
+    // pass. rights is ignored if the terms have no right operand.
+    template <typename Index>
+    void store(int64_t pos, int64_t count, const Index* new_lefts,
+            const Index* new_rights) {
+        assert(0 <= pos && pos + count <= capacity);
+        store_all(lefts, left_width, pos, count, new_lefts, left_base);
+        if (has_right()) {
+            store_all(rights, right_width, pos, count, new_rights, right_base);
+        }
+    }
+
+    void store(int64_t pos, uint32_t left, uint32_t right) {
+        store(pos, 1, &left, &right);
+    }
+};
+
+#endif
@@ -0,0 +1,211 @@
+// Settings shared by all synthesizer variants, usually set from the command
+// line.
+
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+class Expr;
+struct PassStats;
+struct Progress;
+
+// Page sizes that memory can be allocated with (see map_anonymous). If the
+// requested size is unavailable, smaller ones are tried in turn.
+enum class PageSize {
+    // Normal pages.
+    Normal,
+    // Transparent huge pages, requested with madvise.
+    Transparent,
+    // Explicit 2 MB or 1 GB pages, which must be reserved by the
+    // administrator (see /proc/sys/vm/nr_hugepages).
+    Huge2M,
+    Huge1G,
+};
+
+struct AllocPolicy {
+    PageSize page_size = PageSize::Normal;
+
+    // Whether to fault in new memory when it is allocated, instead of on
+    // first use. Only the bank and the set of seen results are prefaulted:
+    // operand storage is sized for the most terms a pass could add, and
+    // mostly goes unused.
+    bool prefault = false;
+};
+
+// How threads are pinned to CPUs (see NumaTopology::cpu_for_thread).
+enum class Affinity {
+    None,
+    Compact,
+    Scatter,
+};
+
+struct Options {
+    // Directory where banks are checkpointed after every pass, and reused by
+    // later runs with the same variables and examples (see bank_file.hpp),
+    // and the size it is kept under. Empty to disable.
+    std::string bank_dir;
+    uint64_t bank_max_bytes = 1ULL << 30;
+
+    // Directory for files backing the bank, for banks that don't fit in
+    // memory (see alloc_spilled). Empty to keep the bank in memory.
+    std::string spill_dir;
+
+    // Directory where solutions are cached across runs (see
+    // solution_cache.hpp), and the size it is kept under. Empty to disable.
+    std::string cache_dir;
+    uint64_t cache_max_bytes = 64 << 20;
+
+    // How memory is allocated. Drivers apply this with set_alloc_policy,
+    // since it is shared by the whole process.
+    AllocPolicy alloc_policy;
+
+    // NUMA placement (see numa.hpp): how threads are pinned, whether seen is
+    // interleaved across nodes, and whether placement is reported after
+    // every synthesis.
+    Affinity affinity = Affinity::None;
+    bool interleave_seen = false;
+    bool numa_report = false;
+
+    // Number of processes that binary passes are split across (see
+    // synth_cpu_mt.hpp). With more than one, the bank is allocated in memory
+    // that is shared with forked processes. Not supported where several jobs
+    // run in one process: with --batch or --shannon, in the server, or in
+    // libsynth.
+    int32_t shards = 1;
+
+    // File that a record is appended to after every pass (see stats.hpp), or
+    // empty to disable.
+    std::string stats_path;
+
+    // File that a timeline of passes, tiles and threads is written to when
+    // the process exits (see trace.hpp), or empty to disable.
+    std::string trace_path;
+
+    // Whether hardware counters are reported after every pass (see
+    // perf.hpp).
+    bool perf = false;
+
+    // How often progress is written to the log while a pass runs, and passed
+    // to on_progress (see progress.hpp), or 0 to disable.
+    uint64_t progress_ms = 0;
+
+    // Budgets, or 0 for none: the wall-clock time of a CEGIS run, the number
+    // of terms in a bank, and the memory allocated for a bank. Synthesis
+    // stops soon after one is exceeded, as though there were no solution,
+    // and reports which (see budget.hpp).
+    uint64_t time_limit_ms = 0;
+    int64_t max_terms = 0;
+    uint64_t max_memory_bytes = 0;
+
+    // The rest are set by programs embedding the synthesizer (see
+    // libsynth.cpp), not from the command line.
+
+    // Where progress is written.
+    std::ostream* log = &std::cerr;
+
+    // If not nullptr, synthesis stops soon after this becomes true, as though
+    // there were no solution (see AbstractSynthesizer::stop_requested).
+    const std::atomic<bool>* cancel = nullptr;
+
+    // When time_limit_ms runs out, set when the run starts (see
+    // start_budget). Embedders may also set it directly.
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::time_point::max();
+
+    // If set, called with every candidate solution found by CEGIS, including
+    // the final one.
+    std::function<void(const Expr*)> on_candidate;
+
+    // If set, called every progress_ms while a pass runs, from another
+    // thread. The pass doesn't end until it returns, so it should be quick.
+    std::function<void(const Progress&)> on_progress;
+
+    // If set, called with the metrics of every pass as it ends (see
+    // stats.hpp).
+    std::function<void(const PassStats&)> on_pass;
+
+    // If arg is a recognized option of the form --key=value, apply it and
+    // return true.
+    bool parse(const std::string &arg) {
+        std::string key = arg.substr(0, arg.find('='));
+        if (arg.find('=') == std::string::npos) {
+            return false;
+        }
+        std::string value = arg.substr(key.size() + 1);
+
+        // Values that aren't numbers, or are out of range, are rejected like
+        // unknown options.
+        try {
+            if (key == "--bank-dir") {
+                bank_dir = value;
+            } else if (key == "--bank-max-mb") {
+                bank_max_bytes = std::stoull(value) << 20;
+            } else if (key == "--spill-dir") {
+                spill_dir = value;
+            } else if (key == "--cache-dir") {
+                cache_dir = value;
+            } else if (key == "--cache-max-mb") {
+                cache_max_bytes = std::stoull(value) << 20;
+            } else if (key == "--pages") {
+                if (value == "normal") {
+                    alloc_policy.page_size = PageSize::Normal;
+                } else if (value == "thp") {
+                    alloc_policy.page_size = PageSize::Transparent;
+                } else if (value == "2m") {
+                    alloc_policy.page_size = PageSize::Huge2M;
+                } else if (value == "1g") {
+                    alloc_policy.page_size = PageSize::Huge1G;
+                } else {
+                    return false;
+                }
+            } else if (key == "--prefault") {
+                alloc_policy.prefault = value == "1";
+            } else if (key == "--affinity") {
+                if (value == "none") {
+                    affinity = Affinity::None;
+                } else if (value == "compact") {
+                    affinity = Affinity::Compact;
+                } else if (value == "scatter") {
+                    affinity = Affinity::Scatter;
+                } else {
+                    return false;
+                }
+            } else if (key == "--interleave-seen") {
+                interleave_seen = value == "1";
+            } else if (key == "--numa-report") {
+                numa_report = value == "1";
+            } else if (key == "--shards") {
+                shards = std::max(1, std::stoi(value));
+            } else if (key == "--stats") {
+                stats_path = value;
+            } else if (key == "--trace") {
+                trace_path = value;
+            } else if (key == "--perf") {
+                perf = value == "1";
+            } else if (key == "--progress-ms") {
+                progress_ms = std::stoull(value);
+            } else if (key == "--time-limit-ms") {
+                time_limit_ms = std::stoull(value);
+            } else if (key == "--max-terms") {
+                max_terms = std::stoll(value);
+            } else if (key == "--max-memory-mb") {
+                max_memory_bytes = std::stoull(value) << 20;
+            } else {
+                return false;
+            }
+        } catch (const std::logic_error&) {
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif
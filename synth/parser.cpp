@@ -6,6 +6,7 @@
 #include <stack>
 #include <bitset>
 #include <random>
+#include <stdexcept>
 using namespace std;
 
 #include "spec.hpp"
@@ -29,6 +30,9 @@ std::string ReplaceAll(std::string str, const std::string& from, const std::stri
  * Java styled pop for a stack; pops and returns the value
 */
 bool popVal(stack<bool> &st) {
+    if (st.empty()) {
+        throw invalid_argument("malformed expression");
+    }
     bool val=st.top();
     st.pop();
     return val;
@@ -64,7 +68,7 @@ bool evalExpr(string expr, vector<string> names, vector<bool> vals) {
     }
 
     // should only ever be one value left, and that's the return
-    return st.top();
+    return popVal(st);
 }
 
 int power(int x, int y) {
@@ -181,6 +185,11 @@ vector<uint32_t> Parser::getVarValues(uint32_t numVariables, uint32_t numExample
 }
 
 Spec Parser::parseTruthTableInput(string inputFileName) {
+    ifstream inputFile(inputFileName);
+    return parseTruthTableInput(inputFile);
+}
+
+Spec Parser::parseTruthTableInput(istream &inputFile) {
     uint32_t numVariables = 0;
     int32_t maxHeight = 0;//e.g. this will be 4 for the D5 files since the grammar has "Start" as a sort of 0 level height
     vector<int32_t> var_heights;//heights range from 0 to maxHeight, represent the "weight" of the variable in the tree
@@ -189,9 +198,6 @@ Spec Parser::parseTruthTableInput(string inputFileName) {
     vector<vector<bool>> all_inputs;
     vector<bool> full_sol;
 
-    //open truth table-formatted input file
-    ifstream inputFile;
-    inputFile.open(inputFileName);
     int spaceAt;
     string inputs;
     // for a particular example
@@ -216,6 +222,9 @@ Spec Parser::parseTruthTableInput(string inputFileName) {
             //input
             inputs = line.substr(0,spaceAt);
 	    //cout << inputs << " " << line.at(spaceAt+1) << endl;
+            if (inputs.length() != var_names.size()) {
+                throw invalid_argument("truth table row doesn't match the variables: " + line);
+            }
             vector<bool> inputVals(var_names.size());
             for (uint32_t i = 0; i < inputs.length(); i++) {
 		        char c = inputs.at(i);
@@ -237,7 +246,9 @@ Spec Parser::parseTruthTableInput(string inputFileName) {
     numVariables = var_names.size();
     num_examples = power(2,numVariables);
     if(num_examples>32) num_examples=32;
-    inputFile.close();
+    if (full_sol.size() < num_examples) {
+        throw invalid_argument("truth table has too few rows");
+    }
 
     /*for (uint32_t i = 0; i < all_inputs.size(); i++) {
 	    for (uint32_t j = 0; j < all_inputs[i].size(); j++) {
@@ -256,15 +267,17 @@ Spec Parser::parseTruthTableInput(string inputFileName) {
 }
 
 Spec Parser::parseInput(string inputFileName) {
+    ifstream inputFile(inputFileName);
+    return parseInput(inputFile);
+}
+
+Spec Parser::parseInput(istream &inputFile) {
     uint32_t numVariables = 0;
     int32_t maxDepth = 0;//e.g. this will be 4 for the D5 files since the grammar has "Start" as a sort of 0 level depth
     vector<int32_t> var_depths;//depths range from 0 to maxDepth, represent the "weight" of the variable in the tree
     vector<string> var_names;
     uint32_t num_examples;
 
-    //open SyGuS-formatted input file
-    ifstream inputFile;
-    inputFile.open(inputFileName);
     int lineNumber = 1;
     string line;
 
@@ -328,7 +341,6 @@ Spec Parser::parseInput(string inputFileName) {
     numVariables = var_names.size();
     num_examples = power(2,numVariables);
     if(num_examples>32) num_examples=32;
-    inputFile.close();
 
     //Flip depths to be "height"s instead
     for (uint32_t i = 0; i < numVariables; i++)
@@ -339,7 +351,7 @@ Spec Parser::parseInput(string inputFileName) {
 
     if (numVariables > 31) {
         // we can't even parse this many. abort
-        cout << "Abandoning this spec because it has too many (" << numVariables << ") variables" << endl;
+        cerr << "Abandoning this spec because it has too many (" << numVariables << ") variables" << endl;
         return Spec(numVariables, 
                 0, 
                 var_names, 
@@ -351,12 +363,12 @@ Spec Parser::parseInput(string inputFileName) {
 
     //sol_result = truthTableWithVec(origCir, var_names, vals);
 
-    cout<<"spec making"<<std::endl;
+    cerr<<"spec making"<<std::endl;
 
     vector<vector<bool>> all_inputs;
     vector<bool> full_sol = truthTableFull(origCir, var_names, all_inputs);
 
-    cout<<"spec made"<<std::endl;
+    cerr<<"spec made"<<std::endl;
 
     return Spec(numVariables, 
                 1, // could be num_examples 
@@ -18,6 +18,10 @@ private:
 public:
     static Spec parseInput(string inputFileName);
     static Spec parseTruthTableInput(string inputFileName);
+
+    // The same, reading the spec from a stream instead of a file.
+    static Spec parseInput(istream &inputFile);
+    static Spec parseTruthTableInput(istream &inputFile);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,209 @@
+// Hardware performance counters per pass, enabled with --perf=1.
+//
+// A group of events is opened with perf_event_open for every thread that runs
+// passes, and the groups are started and stopped together around each pass,
+// so that the counts are those of the pass alone. Events that the CPU or
+// kernel doesn't support are left out, and if none can be opened, e.g.
+// because /proc/sys/kernel/perf_event_paranoid forbids it, synthesis runs
+// without counters. Shard processes (see synth_cpu_mt.hpp) aren't counted.
+
+#ifndef PERF_H
+#define PERF_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+struct PerfEvent {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+};
+
+#ifdef __linux__
+#define PERF_CACHE_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+// The events counted, in the order they are reported.
+const PerfEvent PERF_EVENTS[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"llc-misses", PERF_TYPE_HW_CACHE, PERF_CACHE_MISS(PERF_COUNT_HW_CACHE_LL)},
+    {"dtlb-misses", PERF_TYPE_HW_CACHE, PERF_CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+#else
+const PerfEvent PERF_EVENTS[] = {
+    {"cycles", 0, 0},
+};
+#endif
+
+const size_t PERF_NUM_EVENTS = sizeof(PERF_EVENTS) / sizeof(PERF_EVENTS[0]);
+
+// The kernel's ID of the calling thread.
+pid_t current_thread_id() {
+#ifdef __linux__
+    return syscall(SYS_gettid);
+#else
+    return getpid();
+#endif
+}
+
+// Counts of each event in PERF_EVENTS, summed over every thread.
+struct PerfCounts {
+    uint64_t values[PERF_NUM_EVENTS];
+    bool available[PERF_NUM_EVENTS];
+
+    // Write the counts on one line, with "n/a" for unavailable events.
+    void print(std::ostream &out) const {
+        out << "perf:";
+        for (size_t i = 0; i < PERF_NUM_EVENTS; i++) {
+            out << " " << PERF_EVENTS[i].name << "=";
+            if (available[i]) {
+                out << values[i];
+            } else {
+                out << "n/a";
+            }
+        }
+        // Instructions per cycle, from the first two events.
+        if (available[0] && available[1] && values[0] > 0) {
+            out << " ipc=" << std::fixed << std::setprecision(2)
+                << (double) values[1] / values[0] << std::defaultfloat;
+        }
+        out << std::endl;
+    }
+};
+
+class PerfCounters {
+private:
+    // The events of one thread. The first open event leads the group.
+    struct Group {
+        std::vector<int> fds;
+        std::vector<size_t> events;
+    };
+
+    std::vector<Group> groups;
+
+#ifdef __linux__
+    static int open_event(const PerfEvent &event, pid_t thread, int group_fd) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = event.type;
+        attr.config = event.config;
+        attr.disabled = group_fd == -1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+            | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return syscall(SYS_perf_event_open, &attr, thread, -1, group_fd, 0);
+    }
+
+    void control(unsigned long request) {
+        for (Group &group : groups) {
+            ioctl(group.fds[0], request, PERF_IOC_FLAG_GROUP);
+        }
+    }
+#endif
+
+public:
+    // Open a group of events for each thread. If no event can be opened,
+    // error is set to the reason, and available() is false.
+    PerfCounters(const std::vector<pid_t> &threads, std::string &error) {
+#ifdef __linux__
+        for (pid_t thread : threads) {
+            Group group;
+            for (size_t i = 0; i < PERF_NUM_EVENTS; i++) {
+                int fd = open_event(PERF_EVENTS[i], thread,
+                        group.fds.empty() ? -1 : group.fds[0]);
+                if (fd == -1) {
+                    if (error.empty()) {
+                        error = strerror(errno);
+                    }
+                    continue;
+                }
+                group.fds.push_back(fd);
+                group.events.push_back(i);
+            }
+            if (!group.fds.empty()) {
+                groups.push_back(group);
+            }
+        }
+#else
+        (void) threads;
+        error = "not supported on this platform";
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    ~PerfCounters() {
+        for (Group &group : groups) {
+            for (int fd : group.fds) {
+                close(fd);
+            }
+        }
+    }
+
+    bool available() const {
+        return !groups.empty();
+    }
+
+    // Set the counts back to zero.
+    void reset() {
+#ifdef __linux__
+        control(PERF_EVENT_IOC_RESET);
+#endif
+    }
+
+    void enable() {
+#ifdef __linux__
+        control(PERF_EVENT_IOC_ENABLE);
+#endif
+    }
+
+    void disable() {
+#ifdef __linux__
+        control(PERF_EVENT_IOC_DISABLE);
+#endif
+    }
+
+    // Return the counts since the last reset. If the kernel had to share the
+    // hardware counters with other groups, the counts are scaled up to the
+    // time the group was enabled.
+    PerfCounts read() {
+        PerfCounts counts = {};
+        for (Group &group : groups) {
+            // The number of events, the times enabled and running, and the
+            // value of each event.
+            std::vector<uint64_t> data(3 + group.fds.size());
+            if (::read(group.fds[0], data.data(), data.size() * sizeof(uint64_t))
+                    != (ssize_t) (data.size() * sizeof(uint64_t))) {
+                continue;
+            }
+
+            double scale = data[2] > 0 ? (double) data[1] / data[2] : 0;
+            for (size_t i = 0; i < group.events.size(); i++) {
+                counts.values[group.events[i]] += data[3 + i] * scale;
+                counts.available[group.events[i]] = true;
+            }
+        }
+        return counts;
+    }
+};
+
+#endif
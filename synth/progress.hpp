@@ -0,0 +1,101 @@
+// Progress of long passes, reported every Options::progress_ms while a pass
+// runs.
+//
+// The binary passes know how many tiles they have (see
+// AbstractSynthesizer::tile_range), so counting the tiles that are done is
+// enough to tell how far along a pass is. A reporter thread samples the count,
+// writes a line to the log, and passes the sample to Options::on_progress, so
+// that the workers never wait for the report.
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+// A sample of the pass in progress.
+struct Progress {
+    int32_t height;
+    const char* pass;
+
+    // Tiles of the pass done so far, out of num_tiles, or 0 of 0 for passes
+    // that aren't divided into tiles.
+    int64_t tiles_done;
+    int64_t num_tiles;
+
+    // Terms added by the pass so far, and in the bank.
+    int64_t new_terms;
+    int64_t num_terms;
+
+    // Wall-clock time since the pass started, and the rate it added terms at.
+    uint64_t elapsed_ms;
+    double terms_per_second;
+
+    // Projected time until the pass, and every pass of its height, are done,
+    // or -1 if it can't be projected. The passes left at the height are
+    // assumed to take as long as this one.
+    int64_t pass_eta_ms;
+    int64_t height_eta_ms;
+
+    double fraction() const {
+        return num_tiles > 0 ? (double) tiles_done / num_tiles : 0;
+    }
+
+    void print(std::ostream &out) const {
+        out << "height " << height << ", " << pass << " pass: ";
+        if (num_tiles > 0) {
+            out << std::fixed << std::setprecision(1) << 100 * fraction() << "% of "
+                << num_tiles << " tiles, ";
+        }
+        out << new_terms << " new term(s) at " << std::fixed << std::setprecision(0)
+            << terms_per_second << "/s, " << elapsed_ms << " ms elapsed" << std::defaultfloat;
+        if (pass_eta_ms >= 0) {
+            out << ", pass done in ~" << pass_eta_ms / 1000 << " s";
+        }
+        if (height_eta_ms >= 0) {
+            out << ", height done in ~" << height_eta_ms / 1000 << " s";
+        }
+    }
+};
+
+// Calls report every interval_ms on its own thread, until it is destroyed.
+class ProgressReporter {
+private:
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::thread thread;
+
+public:
+    ProgressReporter(uint64_t interval_ms, std::function<void()> report) :
+        stopping(false),
+        thread([this, interval_ms, report]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!wake.wait_for(lock, std::chrono::milliseconds(interval_ms),
+                        [this]() { return stopping; })) {
+                lock.unlock();
+                report();
+                lock.lock();
+            }
+        }) {}
+
+    ProgressReporter(const ProgressReporter&) = delete;
+    ProgressReporter& operator=(const ProgressReporter&) = delete;
+
+    ~ProgressReporter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        thread.join();
+    }
+};
+
+#endif
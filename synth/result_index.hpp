@@ -0,0 +1,153 @@
+// Reverse index from evaluation results to the index of the term in the bank
+// with that result.
+
+#ifndef RESULT_INDEX_H
+#define RESULT_INDEX_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Banks with at most this many distinct results, which are those of up to 16
+// examples, are indexed by a table with an entry for every result. For wider
+// banks, the table would cost more to fill than the lookups save.
+#define RESULT_INDEX_MAX_TABLE_RESULTS (1 << 16)
+
+// The average number of terms per bucket in the runs that index wider banks.
+#define RESULT_INDEX_BUCKET_TERMS 8
+
+// Every pass adds a contiguous range of terms to the bank (see operands.hpp),
+// so the index is extended with the terms of each pass when it ends, and
+// never rebuilt. A synthesizer looks up only a handful of results, so this is
+// cheap only because updates are sequential passes over the new terms;
+// sorting them would cost more than the lookups save.
+//
+// Narrow banks are indexed by a table from every result to a bank index.
+// Wider banks get a run per pass instead, which holds the terms of the pass
+// grouped into buckets by a hash of their result, with a counting sort. A
+// lookup checks one bucket in each run.
+class ResultIndex {
+public:
+    // Returned by find when no indexed term has the given result.
+    static const int64_t NOT_FOUND = -1;
+
+private:
+    // The i'th element is the bank index of the term whose result is i, or
+    // UINT32_MAX. Empty if the bank is too wide for a table.
+    std::vector<uint32_t> positions;
+
+    // The terms of one pass, by bucket: bucket b holds the bank indices from
+    // terms[bucket_starts[b]] to terms[bucket_starts[b + 1]].
+    struct Run {
+        int32_t bucket_bits;
+        std::vector<uint32_t> bucket_starts;
+        std::vector<uint32_t> terms;
+    };
+    std::vector<Run> runs;
+
+    // The memory allocated for the runs.
+    uint64_t run_bytes = 0;
+
+    // The number of terms indexed, which are the first terms of the bank.
+    int64_t indexed_end = 0;
+
+    // The number of bits of bucket numbers, for a run of count terms.
+    static int32_t bucket_bits(int64_t count) {
+        int32_t bits = 0;
+        while ((RESULT_INDEX_BUCKET_TERMS << bits) < count) {
+            bits++;
+        }
+        return bits;
+    }
+
+    // Fibonacci hashing, so that results that differ only in their high bits
+    // land in different buckets.
+    static uint32_t bucket(uint32_t result, int32_t bits) {
+        return bits == 0 ? 0 : (result * 2654435769U) >> (32 - bits);
+    }
+
+public:
+    explicit ResultIndex(size_t max_distinct_terms) :
+        positions(max_distinct_terms <= RESULT_INDEX_MAX_TABLE_RESULTS
+                ? max_distinct_terms : 0, UINT32_MAX) {}
+
+    // The memory allocated for the index.
+    uint64_t bytes() const {
+        return positions.size() * sizeof(uint32_t) + run_bytes;
+    }
+
+    // An upper bound on the memory that update allocates for count new terms.
+    uint64_t update_bytes(int64_t count) const {
+        if (!positions.empty() || count == 0) {
+            return 0;
+        }
+        return (count + ((int64_t) 1 << bucket_bits(count)) + 1) * sizeof(uint32_t);
+    }
+
+    // The number of terms indexed. Terms after those must be scanned.
+    int64_t end() const {
+        return indexed_end;
+    }
+
+    // Index the terms from end() to num_terms, which were added by one pass.
+    template <typename Result>
+    void update(const Result* term_results, int64_t num_terms) {
+        int64_t start = indexed_end;
+        if (num_terms <= start) {
+            return;
+        }
+        indexed_end = num_terms;
+
+        if (!positions.empty()) {
+            for (int64_t i = start; i < num_terms; i++) {
+                positions[term_results[i]] = i;
+            }
+            return;
+        }
+
+        Run run;
+        int64_t count = num_terms - start;
+        run.bucket_bits = bucket_bits(count);
+        size_t num_buckets = (size_t) 1 << run.bucket_bits;
+        run.bucket_starts.assign(num_buckets + 1, 0);
+        run.terms.resize(count);
+
+        // Count the terms of each bucket, and turn the counts into the end of
+        // each bucket. Terms are then placed from the back, which leaves
+        // bucket_starts at the start of each bucket.
+        for (int64_t i = start; i < num_terms; i++) {
+            run.bucket_starts[bucket(term_results[i], run.bucket_bits)]++;
+        }
+        uint32_t sum = 0;
+        for (size_t b = 0; b <= num_buckets; b++) {
+            sum += run.bucket_starts[b];
+            run.bucket_starts[b] = sum;
+        }
+        for (int64_t i = num_terms - 1; i >= start; i--) {
+            run.terms[--run.bucket_starts[bucket(term_results[i], run.bucket_bits)]] = i;
+        }
+
+        run_bytes += (run.bucket_starts.size() + run.terms.size()) * sizeof(uint32_t);
+        runs.push_back(std::move(run));
+    }
+
+    // Return the bank index of the indexed term with the given result, or
+    // NOT_FOUND.
+    template <typename Result>
+    int64_t find(uint32_t result, const Result* term_results) const {
+        if (!positions.empty()) {
+            return positions[result] == UINT32_MAX ? NOT_FOUND : positions[result];
+        }
+        for (const Run &run : runs) {
+            uint32_t b = bucket(result, run.bucket_bits);
+            for (uint32_t i = run.bucket_starts[b]; i < run.bucket_starts[b + 1]; i++) {
+                if (term_results[run.terms[i]] == result) {
+                    return run.terms[i];
+                }
+            }
+        }
+        return NOT_FOUND;
+    }
+};
+
+#endif
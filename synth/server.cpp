@@ -0,0 +1,67 @@
+// Run the synthesizer variant of your choice as a server (see server.hpp).
+//
+// Usage: synth_cpu_mt_server [--socket=PATH] [--jobs=N] [--max-queue=N] [options]
+//
+// Without --socket, requests are read from stdin and responses written to
+// stdout. Other arguments are Options, which apply to every spec, e.g.
+// --cache-dir=DIR.
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "batch.hpp"
+#include "cegis.hpp"
+#include "expr.hpp"
+#include "options.hpp"
+#include "server.hpp"
+#include "spec.hpp"
+
+#ifndef SYNTH_VARIANT
+#error "SYNTH_VARIANT must be defined. See the Makefile."
+#elif SYNTH_VARIANT == 1
+#include "synth_cpu_st.hpp"
+#define VARIANT_DESCRIPTION "CPU, single threaded"
+#elif SYNTH_VARIANT == 2
+#include "synth_cpu_mt.hpp"
+#define VARIANT_DESCRIPTION "CPU, multi-threaded"
+#elif SYNTH_VARIANT == 3
+#include "synth_gpu.cu"
+#define VARIANT_DESCRIPTION "GPU"
+#else
+#error "Unsupported SYNTH_VARIANT."
+#endif
+
+int main(int argc, char *argv[]) {
+    std::cerr << "Synthesizer variant: " << VARIANT_DESCRIPTION << std::endl;
+
+    Options options;
+    ServerOptions server_options;
+    for (int arg = 1; arg < argc; arg++) {
+        if (!options.parse(argv[arg]) && !server_options.parse(argv[arg])) {
+            std::cerr << "Unknown argument: " << argv[arg] << std::endl;
+            return 1;
+        }
+    }
+    // Jobs run concurrently, and shards can only be forked while no other
+    // thread is running (see synth_cpu_mt.hpp).
+    if (options.shards > 1) {
+        std::cerr << "--shards isn't supported by the server" << std::endl;
+        return 1;
+    }
+    set_alloc_policy(options.alloc_policy);
+
+    Server server(server_options, [&](Spec &spec) {
+        BatchResult result = {false, 0, "", ""};
+        const Expr* expr = cegis<Synthesizer>(spec, nullptr, result.iterations, options,
+                &result.budget);
+        if (expr != nullptr) {
+            std::ostringstream solution;
+            expr->print(solution, &spec.var_names);
+            result.solved = true;
+            result.solution = solution.str();
+        }
+        return result;
+    });
+    server.run(server_options.socket_path);
+}
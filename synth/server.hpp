@@ -0,0 +1,429 @@
+// A long-running synthesis server, so that interactive clients don't pay for
+// process startup and cold allocations on every spec.
+//
+// The server reads requests from stdin, or from clients of a Unix domain
+// socket, and writes one JSON object per line in response. Memory freed by one
+// spec is reused by the next (see RegionPool), the OpenMP team and workers
+// stay alive, and solutions stay in the solution cache, if there is one.
+// Specs are solved concurrently on a shared pool of threads, as in batch mode
+// (see batch.hpp). At most a fixed number of specs may wait for a worker;
+// requests beyond that are rejected at once with the status "busy", so that
+// clients can back off instead of queueing without bound. Specs that exceed
+// a budget, such as --time-limit-ms, get the status "budget_exceeded" (see
+// budget.hpp).
+//
+// Requests are lines of the form "COMMAND ID ARG", where ID is chosen by the
+// client and echoed in the response:
+//
+//   sl ID N     The next N lines are a spec in the SyGuS format.
+//   tt ID N     The next N lines are a spec in the truth table format.
+//   file ID P   Solve the spec in the file P, in the SyGuS format if its name
+//               ends with .sl, and the truth table format otherwise.
+//   stats ID    Respond with the server's counters.
+//
+// Responses to one client are written in the order that specs finish, not the
+// order they were sent.
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "batch.hpp"
+#include "expr.hpp"
+#include "parser.hpp"
+#include "spec.hpp"
+#include "timer.hpp"
+
+// Number of specs that may wait for a worker, per worker, unless set with
+// --max-queue.
+#define SERVER_QUEUE_PER_WORKER 4
+
+struct ServerOptions {
+    // The socket to listen on, or empty to serve stdin and stdout.
+    std::string socket_path;
+
+    // Number of worker threads, or 0 for one per core.
+    int32_t jobs = 0;
+
+    // Number of specs that may wait for a worker, or 0 for
+    // SERVER_QUEUE_PER_WORKER per worker.
+    int32_t max_queue = 0;
+
+    // If arg is a recognized option of the form --key=value, apply it and
+    // return true.
+    bool parse(const std::string &arg) {
+        std::string key = arg.substr(0, arg.find('='));
+        if (arg.find('=') == std::string::npos) {
+            return false;
+        }
+        std::string value = arg.substr(key.size() + 1);
+
+        try {
+            if (key == "--socket") {
+                socket_path = value;
+            } else if (key == "--jobs") {
+                jobs = std::stoi(value);
+            } else if (key == "--max-queue") {
+                max_queue = std::stoi(value);
+            } else {
+                return false;
+            }
+        } catch (const std::logic_error&) {
+            return false;
+        }
+        return true;
+    }
+};
+
+class Server {
+public:
+    // Solves one spec, on the calling thread.
+    typedef std::function<BatchResult(Spec&)> Solver;
+
+private:
+    // A client, which may have several specs in flight. Each response is
+    // written whole, so that concurrent responses don't interleave. The
+    // connection is closed once the client has stopped sending requests and
+    // every response has been written.
+    class Connection {
+    private:
+        int in_fd;
+        int out_fd;
+        std::mutex mutex;
+        std::string buffer;
+
+    public:
+        Connection(int in_fd, int out_fd) : in_fd(in_fd), out_fd(out_fd) {}
+
+        ~Connection() {
+            if (in_fd != STDIN_FILENO) {
+                close(in_fd);
+            }
+        }
+
+        // Read the next line, without its newline. Returns false at the end
+        // of the input.
+        bool read_line(std::string &line) {
+            while (true) {
+                size_t newline = buffer.find('\n');
+                if (newline != std::string::npos) {
+                    line = buffer.substr(0, newline);
+                    buffer.erase(0, newline + 1);
+                    return true;
+                }
+
+                char chunk[4096];
+                ssize_t count = read(in_fd, chunk, sizeof(chunk));
+                if (count <= 0) {
+                    return false;
+                }
+                buffer.append(chunk, count);
+            }
+        }
+
+        // Write a line. Errors are ignored, since they mean that the client
+        // has gone away, and there is no one left to tell.
+        void write_line(const std::string &line) {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::string data = line + "\n";
+            for (size_t written = 0; written < data.size(); ) {
+                ssize_t count = write(out_fd, data.data() + written, data.size() - written);
+                if (count <= 0) {
+                    return;
+                }
+                written += count;
+            }
+        }
+    };
+
+    struct Job {
+        std::shared_ptr<Connection> connection;
+        std::string id;
+        std::unique_ptr<Spec> spec;
+
+        // Started when the spec is queued.
+        Timer timer;
+    };
+
+    const int32_t num_workers;
+    const size_t max_queue;
+    Solver solver;
+    ThreadBudget budget;
+
+    std::mutex mutex;
+
+    // Specs waiting for a worker, and whether no more will be added.
+    std::condition_variable queue_changed;
+    std::deque<Job> queue;
+    bool closing = false;
+
+    // Counters reported by the stats command.
+    uint64_t num_requests = 0;
+    uint64_t num_solved = 0;
+    uint64_t num_rejected = 0;
+    uint64_t num_errors = 0;
+    int32_t num_running = 0;
+
+    static std::string error_response(const std::string &id, const std::string &message) {
+        return "{\"id\": " + json_string(id) + ", \"status\": \"error\", \"message\": "
+            + json_string(message) + "}";
+    }
+
+    std::string stats_response(const std::string &id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ostringstream out;
+        out << "{\"id\": " << json_string(id)
+            << ", \"status\": \"stats\""
+            << ", \"requests\": " << num_requests
+            << ", \"solved\": " << num_solved
+            << ", \"rejected\": " << num_rejected
+            << ", \"errors\": " << num_errors
+            << ", \"running\": " << num_running
+            << ", \"queued\": " << queue.size()
+            << ", \"workers\": " << num_workers << "}";
+        return out.str();
+    }
+
+    // Parse the spec of a request whose first line has been read. Returns
+    // nullptr, and sets error, if the request is malformed.
+    static std::unique_ptr<Spec> read_spec(Connection &connection,
+            const std::string &command, const std::string &arg, std::string &error) {
+        std::unique_ptr<Spec> spec;
+        try {
+            if (command == "file") {
+                std::ifstream in(arg);
+                if (!in) {
+                    error = "can't open " + arg;
+                    return nullptr;
+                }
+                bool sygus = arg.size() >= 3 && arg.compare(arg.size() - 3, 3, ".sl") == 0;
+                spec = std::make_unique<Spec>(sygus
+                        ? Parser::parseInput(in) : Parser::parseTruthTableInput(in));
+            } else {
+                int64_t num_lines = std::stoll(arg);
+                std::string text, line;
+                for (int64_t i = 0; i < num_lines; i++) {
+                    if (!connection.read_line(line)) {
+                        error = "spec ended early";
+                        return nullptr;
+                    }
+                    text += line + "\n";
+                }
+                std::istringstream in(text);
+                spec = std::make_unique<Spec>(command == "sl"
+                        ? Parser::parseInput(in) : Parser::parseTruthTableInput(in));
+            }
+        } catch (const std::exception &e) {
+            error = std::string("can't parse spec: ") + e.what();
+            return nullptr;
+        }
+
+        if (spec->num_vars == 0 || spec->num_vars > SPEC_MAX_VARS) {
+            error = "unsupported number of variables (" + std::to_string(spec->num_vars) + ")";
+            return nullptr;
+        }
+        return spec;
+    }
+
+    // Read requests from a client until it stops sending them.
+    void serve(std::shared_ptr<Connection> connection) {
+        std::string line;
+        while (connection->read_line(line)) {
+            std::istringstream words(line);
+            std::string command, id, arg;
+            if (!(words >> command >> id)) {
+                if (!line.empty()) {
+                    connection->write_line(error_response(id, "expected COMMAND ID ARG"));
+                }
+                continue;
+            }
+            words >> arg;
+
+            if (command == "stats") {
+                connection->write_line(stats_response(id));
+                continue;
+            }
+            if (command != "sl" && command != "tt" && command != "file") {
+                connection->write_line(error_response(id, "unknown command " + command));
+                continue;
+            }
+            if (arg.empty()) {
+                connection->write_line(error_response(id, "expected COMMAND ID ARG"));
+                continue;
+            }
+
+            std::string error;
+            std::unique_ptr<Spec> spec = read_spec(*connection, command, arg, error);
+
+            std::unique_lock<std::mutex> lock(mutex);
+            num_requests++;
+            if (spec == nullptr) {
+                num_errors++;
+                lock.unlock();
+                connection->write_line(error_response(id, error));
+            } else if (queue.size() >= max_queue) {
+                num_rejected++;
+                lock.unlock();
+                connection->write_line("{\"id\": " + json_string(id) + ", \"status\": \"busy\"}");
+            } else {
+                queue.push_back({connection, id, std::move(spec), Timer()});
+                queue_changed.notify_all();
+            }
+        }
+    }
+
+    void work() {
+        while (true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                queue_changed.wait(lock, [&]() { return !queue.empty() || closing; });
+                if (queue.empty()) {
+                    return;
+                }
+                job = std::move(queue.front());
+                queue.pop_front();
+                num_running++;
+            }
+            uint64_t queue_ms = job.timer.ms();
+
+            int32_t threads = batch_threads(*job.spec, num_workers);
+            budget.acquire(threads);
+#ifdef _OPENMP
+            omp_set_num_threads(threads);
+#endif
+
+            // Expressions for this spec are freed once the response is
+            // written.
+            ExprArena arena;
+            ExprArena::Scope scope(arena);
+            Timer timer;
+            BatchResult result;
+            try {
+                result = solver(*job.spec);
+            } catch (const std::exception &e) {
+                // A job that fails, say because its bank can't be allocated,
+                // gets an error response, and the server carries on.
+                budget.release(threads);
+                job.connection->write_line(error_response(job.id, e.what()));
+                std::lock_guard<std::mutex> lock(mutex);
+                num_running--;
+                num_errors++;
+                continue;
+            }
+            uint64_t ms = timer.ms();
+            budget.release(threads);
+
+            std::ostringstream response;
+            response << "{\"id\": " << json_string(job.id)
+                << ", \"status\": \"" << batch_status(result) << "\""
+                << ", \"iterations\": " << result.iterations
+                << ", \"threads\": " << threads
+                << ", \"queue_ms\": " << queue_ms
+                << ", \"ms\": " << ms;
+            if (result.solved) {
+                response << ", \"solution\": " << json_string(result.solution);
+            }
+            write_budget_fields(response, result);
+            response << "}";
+            job.connection->write_line(response.str());
+
+            std::lock_guard<std::mutex> lock(mutex);
+            num_running--;
+            num_solved += result.solved;
+        }
+    }
+
+    // Accept clients on the socket forever, serving each on its own thread.
+    void listen_on(const std::string &path) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        struct sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (fd == -1 || path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Can't create socket " << path << std::endl;
+            std::exit(1);
+        }
+        path.copy(address.sun_path, sizeof(address.sun_path) - 1);
+
+        // A socket left behind by a previous server would make bind fail.
+        unlink(path.c_str());
+        if (bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(fd, 64) != 0) {
+            std::perror(path.c_str());
+            std::exit(1);
+        }
+        std::cerr << "Listening on " << path << std::endl;
+
+        while (true) {
+            int client = accept(fd, nullptr, nullptr);
+            if (client == -1) {
+                continue;
+            }
+            std::thread([this, client]() {
+                serve(std::make_shared<Connection>(client, client));
+            }).detach();
+        }
+    }
+
+public:
+    Server(const ServerOptions &options, Solver solver) :
+        num_workers(options.jobs > 0 ? options.jobs
+                : std::max(1U, std::thread::hardware_concurrency())),
+        max_queue(options.max_queue > 0 ? options.max_queue
+                : num_workers * SERVER_QUEUE_PER_WORKER),
+        solver(solver),
+        budget(num_workers) {}
+
+    // Serve clients on socket_path, which never returns, or serve stdin until
+    // it ends, and return once every response has been written.
+    void run(const std::string &socket_path) {
+        // Writing to a client that has gone away must not kill the server.
+        std::signal(SIGPIPE, SIG_IGN);
+
+        std::cerr << "Serving with " << num_workers << " worker(s)" << std::endl;
+        std::vector<std::thread> workers;
+        for (int32_t i = 0; i < num_workers; i++) {
+            workers.emplace_back([this]() { work(); });
+        }
+
+        if (!socket_path.empty()) {
+            listen_on(socket_path);
+        }
+
+        serve(std::make_shared<Connection>(STDIN_FILENO, STDOUT_FILENO));
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
+            queue_changed.notify_all();
+        }
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+    }
+};
+
+#endif
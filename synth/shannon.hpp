@@ -0,0 +1,246 @@
+// Divide-and-conquer synthesis using Shannon decomposition.
+//
+// Any function f can be written in terms of its cofactors with respect to a
+// variable x, f0 = f[x := 0] and f1 = f[x := 1], as
+//
+//     f = f0 ^ (x & (f0 ^ f1))
+//
+// If x has height at most sol_height - 2, then it suffices to find f0 with
+// height sol_height - 1 and g = f0 ^ f1 with height sol_height - 2, and the
+// combined expression still fits in sol_height. Both subproblems have one less
+// variable, half as many rows in their truth tables, and a smaller height
+// budget, so their banks are much smaller than the bank for f.
+
+#ifndef SHANNON_H
+#define SHANNON_H
+
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "cegis.hpp"
+#include "expr.hpp"
+#include "options.hpp"
+#include "spec.hpp"
+
+// Return the variable to split on, or -1 if no variable leaves enough height
+// for the AND and XOR above the cofactors. Variables with larger heights are
+// used closer to the root, so we prefer the tallest one that fits.
+int32_t shannon_choose_var(const Spec &spec) {
+    int32_t best = -1;
+    for (uint32_t i = 0; i < spec.num_vars; i++) {
+        if (spec.var_heights[i] > spec.sol_height - 2) {
+            continue;
+        }
+        if (best == -1 || spec.var_heights[i] > spec.var_heights[best]) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// Truth tables of f0 and g = f0 ^ f1, over every variable except the one we
+// split on.
+struct ShannonCofactors {
+    std::vector<std::vector<bool>> inputs;
+    std::vector<bool> f0_sols;
+    std::vector<bool> g_sols;
+
+    // Split the truth table of spec on the given variable. Returns false if
+    // some row has no partner row differing only in that variable, since the
+    // cofactors are not fully specified in that case.
+    bool split(const Spec &spec, uint32_t var) {
+        std::map<std::vector<bool>, size_t> one_rows;
+        size_t num_zero_rows = 0;
+        for (size_t row = 0; row < spec.all_inputs.size(); row++) {
+            if (spec.all_inputs[row][var]) {
+                std::vector<bool> rest = spec.all_inputs[row];
+                rest.erase(rest.begin() + var);
+                one_rows[rest] = row;
+            } else {
+                num_zero_rows++;
+            }
+        }
+
+        if (num_zero_rows != one_rows.size()) {
+            return false;
+        }
+
+        for (size_t row = 0; row < spec.all_inputs.size(); row++) {
+            if (spec.all_inputs[row][var]) {
+                continue;
+            }
+
+            std::vector<bool> rest = spec.all_inputs[row];
+            rest.erase(rest.begin() + var);
+            auto partner = one_rows.find(rest);
+            if (partner == one_rows.end()) {
+                return false;
+            }
+
+            bool f0 = spec.all_sols[row];
+            bool f1 = spec.all_sols[partner->second];
+            inputs.push_back(rest);
+            f0_sols.push_back(f0);
+            g_sols.push_back(f0 ^ f1);
+        }
+
+        return true;
+    }
+};
+
+// Build the spec for a cofactor, with the given variable removed.
+Spec shannon_subspec(const Spec &spec, uint32_t var, int32_t sol_height,
+        const std::vector<std::vector<bool>> &inputs,
+        const std::vector<bool> &sols) {
+    std::vector<std::string> var_names = spec.var_names;
+    std::vector<int32_t> var_heights = spec.var_heights;
+    var_names.erase(var_names.begin() + var);
+    var_heights.erase(var_heights.begin() + var);
+
+    return Spec(
+        spec.num_vars - 1,
+        1,
+        var_names,
+        var_heights,
+        sol_height,
+        inputs,
+        sols
+    );
+}
+
+bool all_equal(const std::vector<bool> &values, bool expected) {
+    for (bool value : values) {
+        if (value != expected) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Like cegis, but try to split the problem with a Shannon decomposition
+// first. The two cofactors are synthesized in parallel, each with its own
+// synthesizer instances and half of the caller's threads, or one after the
+// other if the caller has a single thread. Falls back to synthesizing spec directly if there is
+// no suitable variable, or if either cofactor can't be synthesized within its
+// reduced height. The time limit of options covers the whole decomposition,
+// and budget is set as for cegis.
+template <typename Synth>
+const Expr* shannon_cegis(Spec &spec, std::ostream *log, int32_t &iterations,
+        const Options &run_options = Options(), BudgetStatus* budget = nullptr) {
+    const Options options = start_budget(run_options);
+    int32_t var = shannon_choose_var(spec);
+
+    ShannonCofactors cofactors;
+    if (var == -1 || !cofactors.split(spec, var)) {
+        return cegis<Synth>(spec, log, iterations, options, budget);
+    }
+
+    // Neither cofactor is needed if it is constant zero, and if g is constant
+    // one, then f = f0 ^ x. If both cofactors are zero, f is constant zero,
+    // which is easier to leave to the direct synthesizer.
+    bool f0_zero = all_equal(cofactors.f0_sols, false);
+    bool g_zero = all_equal(cofactors.g_sols, false);
+    bool g_one = all_equal(cofactors.g_sols, true);
+    if (f0_zero && g_zero) {
+        return cegis<Synth>(spec, log, iterations, options, budget);
+    }
+
+    if (log != nullptr) {
+        *log << "Shannon decomposition on " << spec.var_names[var] << std::endl;
+    }
+
+    Spec f0_spec = shannon_subspec(spec, var, spec.sol_height - 1,
+            cofactors.inputs, cofactors.f0_sols);
+    Spec g_spec = shannon_subspec(spec, var, spec.sol_height - 2,
+            cofactors.inputs, cofactors.g_sols);
+
+    // The cofactors share the caller's threads, which may be all that it was
+    // granted (see ThreadBudget), so each gets half of them. With a single
+    // thread, they are synthesized one after the other.
+#ifdef _OPENMP
+    int32_t threads = omp_get_max_threads();
+#else
+    int32_t threads = 1;
+#endif
+    bool g_needed = !g_zero && !g_one;
+    bool parallel = g_needed && !f0_zero && threads > 1;
+
+    const Expr* g = nullptr;
+    int32_t g_iterations = 0;
+    std::thread g_thread;
+    if (parallel) {
+        // Build g in the caller's arena, so that it lives as long as f0. New
+        // threads don't inherit the caller's number of threads, so g's is set
+        // explicitly.
+        ExprArena &arena = ExprArena::current();
+        g_thread = std::thread([&]() {
+            ExprArena::Scope scope(arena);
+#ifdef _OPENMP
+            omp_set_num_threads(threads / 2);
+#endif
+            g = cegis<Synth>(g_spec, nullptr, g_iterations, options);
+        });
+    } else if (g_needed) {
+        g = cegis<Synth>(g_spec, nullptr, g_iterations, options);
+    }
+
+    const Expr* f0 = nullptr;
+    int32_t f0_iterations = 0;
+    if (!f0_zero) {
+#ifdef _OPENMP
+        omp_set_num_threads(parallel ? threads - threads / 2 : threads);
+#endif
+        f0 = cegis<Synth>(f0_spec, nullptr, f0_iterations, options);
+#ifdef _OPENMP
+        omp_set_num_threads(threads);
+#endif
+    }
+
+    if (g_thread.joinable()) {
+        g_thread.join();
+    }
+
+    iterations = f0_iterations + g_iterations;
+
+    if ((!f0_zero && f0 == nullptr) || (!g_zero && !g_one && g == nullptr)) {
+        if (log != nullptr) {
+            *log << "Shannon decomposition failed, synthesizing directly" << std::endl;
+        }
+        int32_t direct_iterations;
+        const Expr* expr = cegis<Synth>(spec, log, direct_iterations, options, budget);
+        iterations += direct_iterations;
+        return expr;
+    }
+
+    // Map the variables of the cofactors back to the original variables.
+    std::vector<int32_t> var_map;
+    for (uint32_t i = 0; i + 1 < spec.num_vars; i++) {
+        var_map.push_back(i < (uint32_t) var ? i : i + 1);
+    }
+
+    const Expr* expr = nullptr;
+    if (g_one) {
+        expr = Expr::Var(var);
+    } else if (!g_zero) {
+        expr = Expr::And(Expr::Var(var), g->with_vars(var_map));
+    }
+    if (!f0_zero) {
+        const Expr* mapped_f0 = f0->with_vars(var_map);
+        expr = expr == nullptr ? mapped_f0 : Expr::Xor(mapped_f0, expr);
+    }
+
+    assert(expr->height(spec.var_heights) <= spec.sol_height);
+    assert(spec.counterexample(expr) == -1);
+    return expr;
+}
+
+#endif
@@ -0,0 +1,129 @@
+// On-disk cache of solutions, shared by every run on one host.
+//
+// The same functions are often synthesized again, with the same truth table
+// and heights, so solutions are stored in a directory with one file per spec.
+// The file name is a hash of the canonical truth table (its rows in sorted
+// order), the variable heights, and sol_height, and the file holds the
+// serialized solution (see Expr::serialize). Entries are checked against the
+// spec when they are loaded, so a corrupt entry or a hash collision can't
+// produce a wrong solution, only a cache miss.
+//
+// Entries are written atomically (see BankFileWriter), so concurrent
+// processes only ever see complete entries. When the directory grows beyond
+// its size limit, the least recently used entries are removed.
+
+#ifndef SOLUTION_CACHE_H
+#define SOLUTION_CACHE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "bank_file.hpp"
+#include "expr.hpp"
+#include "spec.hpp"
+
+#define SOLUTION_CACHE_MAGIC "SYNTHSOL"
+#define SOLUTION_CACHE_VERSION 1
+
+class SolutionCache {
+private:
+    std::string dir;
+    uint64_t max_bytes;
+
+    // Where entries that are ignored are reported.
+    std::ostream &log;
+
+    // Return the path of the entry for spec.
+    std::string entry_path(const Spec &spec) const {
+        // The rows of the truth table can be in any order, so hash them in
+        // sorted order.
+        std::vector<std::pair<std::vector<bool>, bool>> rows;
+        for (size_t row = 0; row < spec.all_inputs.size(); row++) {
+            rows.push_back({spec.all_inputs[row], spec.all_sols[row]});
+        }
+        std::sort(rows.begin(), rows.end());
+
+        // 64-bit FNV-1a, as in bank_file_name.
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        auto mix = [&](uint32_t value) {
+            for (int32_t i = 0; i < 4; i++) {
+                hash ^= (value >> (8 * i)) & 0xff;
+                hash *= 0x100000001b3ULL;
+            }
+        };
+        mix(spec.num_vars);
+        for (uint32_t i = 0; i < spec.num_vars; i++) {
+            mix(spec.var_heights[i]);
+        }
+        mix(spec.sol_height);
+        mix(rows.size());
+        for (auto &[inputs, sol] : rows) {
+            for (bool input : inputs) {
+                mix(input);
+            }
+            mix(sol);
+        }
+
+        std::ostringstream path;
+        path << dir << "/sol-" << std::hex << hash << ".txt";
+        return path.str();
+    }
+
+public:
+    SolutionCache(const std::string &dir, uint64_t max_bytes, std::ostream &log) :
+        dir(dir), max_bytes(max_bytes), log(log) {}
+
+    // Return a solution for spec, in the current arena, or nullptr if there is
+    // no valid entry for it.
+    const Expr* lookup(Spec &spec) {
+        std::string path = entry_path(spec);
+        std::ifstream in(path);
+        if (!in) {
+            return nullptr;
+        }
+
+        std::string magic;
+        int32_t version;
+        if (!(in >> magic >> version) || magic != SOLUTION_CACHE_MAGIC
+                || version != SOLUTION_CACHE_VERSION) {
+            log << "Ignoring cache entry " << path << ": header doesn't match" << std::endl;
+            return nullptr;
+        }
+
+        const Expr* solution = Expr::deserialize(in, spec.num_vars);
+        if (solution == nullptr || !spec.solves(solution)) {
+            log << "Ignoring cache entry " << path << ": not a solution" << std::endl;
+            return nullptr;
+        }
+
+        // Mark the entry as recently used.
+        std::error_code error;
+        std::filesystem::last_write_time(path,
+                std::filesystem::file_time_type::clock::now(), error);
+        return solution;
+    }
+
+    // Add a solution for spec, replacing any existing entry. Failures are
+    // reported but otherwise ignored, since the cache is only an optimization.
+    void store(const Spec &spec, const Expr* solution) {
+        std::ostringstream entry;
+        entry << SOLUTION_CACHE_MAGIC << " " << SOLUTION_CACHE_VERSION << "\n";
+        solution->serialize(entry);
+        std::string data = entry.str();
+
+        BankFileWriter writer(entry_path(spec));
+        writer.write(data.data(), data.size());
+        if (writer.commit()) {
+            evict_lru(dir, "sol-", ".txt", max_bytes);
+        }
+    }
+};
+
+#endif
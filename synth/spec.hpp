@@ -11,6 +11,10 @@
 
 #include "expr.hpp"
 
+// Specs with more variables are rejected by the server and the library, since
+// their full truth table, which a spec holds, would be too large.
+#define SPEC_MAX_VARS 20
+
 class Spec {
 public:
     // Number of variables.
@@ -88,6 +92,13 @@ public:
         }
 
     
+    // The seed that examples are drawn with, or 0 to seed from the time, so
+    // that benchmarks (see bench.cpp) can repeat the same runs.
+    static uint64_t& example_seed() {
+        static uint64_t seed = 0;
+        return seed;
+    }
+
     // Pull a random set of 32 input/output examples from the entire truth table (truth table could be incomplete)
     // Returns an integer holding the output values for the selected examples (ith bit has the output for the ith example)
     void setExamplesFromFullTable() {
@@ -106,7 +117,7 @@ public:
         // (If we have fewer than 5 variables, we'll just shuffle the < 32 indices into some other order, 
         // and we'll end up taking all of them anyway)
         auto rng = std::default_random_engine{};
-        rng.seed(time(NULL));
+        rng.seed(example_seed() != 0 ? example_seed() : time(NULL));
         shuffle(begin(indices), end(indices), rng);
         std::vector<bool> currExample;
         for (uint32_t i = 0; i < num_examples; i++) {
@@ -123,17 +134,19 @@ public:
 
     void validate(const Expr* solution) {
         solution->assert_constant_height(sol_height, var_heights);
-        for (uint32_t example = 0; example < num_examples; example++) {
-            std::vector<bool> vars;
-            for (uint32_t var = 0; var < num_vars; var++) {
-                vars.push_back((var_values[var] >> example) & 1);
-            }
-            bool expected = (sol_result >> example) & 1;
-	    //std::cout << "Validating: " << std::endl;
-	    //std::cout << solution->eval(vars) << std::endl;
-	    //std::cout << expected << std::endl;
-            assert(solution->eval(vars) == expected);
-        }
+        // Every example fits in one evaluation of 64 inputs, where the values
+        // of variable i are var_values[i].
+        std::vector<uint64_t> vars(var_values.begin(), var_values.end());
+        uint64_t example_mask = (1ULL << num_examples) - 1;
+        assert(((solution->eval_bits(vars) ^ sol_result) & example_mask) == 0);
+    }
+
+    // Return true if solution fits in sol_height and is correct on the whole
+    // truth table. Unlike validate, this doesn't require a constant height
+    // solution, and doesn't abort if the solution is wrong.
+    bool solves(const Expr* solution) {
+        return solution->height(var_heights) <= sol_height
+            && counterexample(solution) == -1;
     }
 
     int advanceCEGISIteration(const Expr* solution) {
@@ -158,9 +171,24 @@ public:
     }
 
     int counterexample(const Expr* solution) {
-        for(uint32_t example=0; example<all_inputs.size(); example++) {
-            if(solution->eval(all_inputs[example])!=all_sols[example]) {
-                return example;
+        // Evaluate 64 rows of the truth table at a time, walking the solution
+        // only once.
+        ExprEvaluator evaluator(solution);
+        for(uint32_t start=0; start<all_inputs.size(); start+=64) {
+            uint32_t end = std::min((uint32_t) all_inputs.size(), start + 64);
+            std::vector<uint64_t> vars(num_vars, 0);
+            uint64_t expected = 0;
+            for(uint32_t example=start; example<end; example++) {
+                for(uint32_t var=0; var<num_vars; var++) {
+                    vars[var] |= (uint64_t) all_inputs[example][var] << (example - start);
+                }
+                expected |= (uint64_t) all_sols[example] << (example - start);
+            }
+
+            uint64_t row_mask = end - start == 64 ? ~0ULL : (1ULL << (end - start)) - 1;
+            uint64_t wrong = (evaluator.eval_bits(vars) ^ expected) & row_mask;
+            if(wrong != 0) {
+                return start + __builtin_ctzll(wrong);
             }
         }
         return -1;
@@ -0,0 +1,148 @@
+// Per-pass metrics, written to a file with --stats=FILE so that the efficiency
+// of the passes can be tracked across runs.
+//
+// Every pass gets a record with its timing and the number of terms it added.
+// Builds with -D SYNTH_STATS (make STATS=1) also count the work done by the
+// pass kernels (see PassCounters). The counters are compiled out otherwise,
+// since some of them are updated in the innermost loops.
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "alloc.hpp"
+
+// Evaluate statement only in builds with counters.
+#ifdef SYNTH_STATS
+#define STATS(statement) statement
+#else
+#define STATS(statement)
+#endif
+
+// Work done by one thread in a pass.
+struct PassCounters {
+    // Candidate results looked up in seen: operand pairs for binary passes,
+    // operands for unary passes, and variables.
+    uint64_t probes;
+
+    // Probes that found the result already in the bank.
+    uint64_t hits;
+
+    // Calls to alloc_terms, each an atomic increment in the multi-threaded
+    // variant.
+    uint64_t alloc_calls;
+
+    // Tiles run, and tiles skipped because a solution had been found or
+    // synthesis was stopped.
+    uint64_t tiles;
+    uint64_t skipped_tiles;
+
+    void add(const PassCounters &other) {
+        probes += other.probes;
+        hits += other.hits;
+        alloc_calls += other.alloc_calls;
+        tiles += other.tiles;
+        skipped_tiles += other.skipped_tiles;
+    }
+};
+
+// One PassCounters for each thread, or for each shard process, so that they
+// can count without contending with each other.
+class PassCounterSlots {
+private:
+    // Each slot has its own cache line.
+    struct alignas(64) Slot {
+        PassCounters counters;
+    };
+
+    size_t num_slots;
+    Slot* slots;
+
+public:
+    // With shared, the slots stay shared with processes forked afterwards.
+    PassCounterSlots(size_t num_slots, bool shared = false) :
+        num_slots(num_slots),
+        slots((Slot*) (shared ? alloc_shared(num_slots * sizeof(Slot))
+                    : alloc(num_slots * sizeof(Slot)))) {}
+
+    PassCounterSlots(const PassCounterSlots&) = delete;
+    PassCounterSlots& operator=(const PassCounterSlots&) = delete;
+
+    ~PassCounterSlots() {
+        dealloc(slots, num_slots * sizeof(Slot));
+    }
+
+    PassCounters& operator[](size_t slot) {
+        return slots[slot].counters;
+    }
+
+    void reset() {
+        memset(slots, 0, num_slots * sizeof(Slot));
+    }
+
+    PassCounters total() {
+        PassCounters sum = {};
+        for (size_t i = 0; i < num_slots; i++) {
+            sum.add(slots[i].counters);
+        }
+        return sum;
+    }
+};
+
+struct PassStats {
+    int32_t num_examples;
+    int32_t height;
+    const char* pass;
+    uint64_t ns;
+    int64_t new_terms;
+    int64_t total_terms;
+    PassCounters counters;
+};
+
+// Append a record to the stats file at path: a CSV row if its name ends with
+// .csv, with a header if the file is new, or else a line of JSON. Each record
+// is written at once, so that synthesizers running concurrently can share the
+// file.
+void write_pass_stats(const std::string &path, const PassStats &stats) {
+    std::ofstream out(path, std::ios::app);
+    if (!out) {
+        return;
+    }
+
+    std::ostringstream record;
+    if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0) {
+        out.seekp(0, std::ios::end);
+        if (out.tellp() == 0) {
+            record << "num_examples,height,pass,ns,new_terms,total_terms";
+            STATS(record << ",probes,hits,alloc_calls,tiles,skipped_tiles");
+            record << "\n";
+        }
+        record << stats.num_examples << "," << stats.height << "," << stats.pass
+            << "," << stats.ns << "," << stats.new_terms << "," << stats.total_terms;
+        STATS(record << "," << stats.counters.probes << "," << stats.counters.hits
+                << "," << stats.counters.alloc_calls << "," << stats.counters.tiles
+                << "," << stats.counters.skipped_tiles);
+        record << "\n";
+    } else {
+        record << "{\"num_examples\": " << stats.num_examples
+            << ", \"height\": " << stats.height
+            << ", \"pass\": \"" << stats.pass << "\""
+            << ", \"ns\": " << stats.ns
+            << ", \"new_terms\": " << stats.new_terms
+            << ", \"total_terms\": " << stats.total_terms;
+        STATS(record << ", \"probes\": " << stats.counters.probes
+                << ", \"hits\": " << stats.counters.hits
+                << ", \"alloc_calls\": " << stats.counters.alloc_calls
+                << ", \"tiles\": " << stats.counters.tiles
+                << ", \"skipped_tiles\": " << stats.counters.skipped_tiles);
+        record << "}\n";
+    }
+    out << record.str() << std::flush;
+}
+
+#endif
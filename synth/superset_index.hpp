@@ -0,0 +1,168 @@
+// Index over the results in the bank, used by the AndCheck and OrCheck passes
+// to find a pair of terms whose AND is equal to a target, without enumerating
+// every pair of terms.
+
+#ifndef SUPERSET_INDEX_H
+#define SUPERSET_INDEX_H
+
+#include <cstdint>
+#include <vector>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+// The largest number of free bits for which we are willing to build the
+// subset table (2^22 entries, 16 MiB).
+#define SUBSET_TABLE_MAX_BITS 22
+
+class SupersetIndex {
+public:
+    // Returned by find_disjoint when there is no matching term.
+    static const int64_t NOT_FOUND = -1;
+
+private:
+    // We are looking for a and b such that (a & b) == target. This requires
+    // both a and b to be supersets of target, and the bits of a and b outside
+    // target (the "extra" bits) must be disjoint.
+    const uint32_t target;
+
+    // The bits which are not in target.
+    const uint32_t free_mask;
+
+    const int32_t num_free_bits;
+
+    // Extra bits (compressed to num_free_bits bits) and bank index of every
+    // term that is a superset of the target.
+    std::vector<uint32_t> extras;
+    std::vector<uint32_t> indices;
+
+    // If nonempty, the i'th element is the bank index of a term whose extra
+    // bits are a subset of i, or UINT32_MAX if there is none. Index UINT32_MAX
+    // can't be confused with a real term: a bank that large would contain
+    // every possible result, including the target.
+    std::vector<uint32_t> subset_table;
+
+    // Otherwise, extras and indices are sorted by the number of extra bits,
+    // and the i'th element is the position of the first term with more than
+    // i extra bits.
+    std::vector<size_t> popcount_ends;
+
+    // Pack the bits of value selected by mask into the low bits.
+    static uint32_t compress(uint32_t value, uint32_t mask) {
+#ifdef __BMI2__
+        return _pext_u32(value, mask);
+#else
+        uint32_t packed = 0;
+        for (uint32_t bit = 1; mask != 0; bit <<= 1) {
+            uint32_t lowest = mask & -mask;
+            if (value & lowest) {
+                packed |= bit;
+            }
+            mask ^= lowest;
+        }
+        return packed;
+#endif
+    }
+
+    void build_subset_table() {
+        subset_table.assign(1ULL << num_free_bits, UINT32_MAX);
+        for (size_t i = 0; i < extras.size(); i++) {
+            subset_table[extras[i]] = indices[i];
+        }
+
+        // Sum over subsets: afterwards, each entry holds a term whose extra
+        // bits are a subset of the entry's position.
+        for (int32_t bit = 0; bit < num_free_bits; bit++) {
+            uint32_t bit_mask = 1U << bit;
+            for (uint64_t i = 0; i < subset_table.size(); i++) {
+                if ((i & bit_mask) && subset_table[i] == UINT32_MAX) {
+                    subset_table[i] = subset_table[i ^ bit_mask];
+                }
+            }
+        }
+    }
+
+    void sort_by_popcount() {
+        popcount_ends.assign(num_free_bits + 1, 0);
+        for (uint32_t extra : extras) {
+            popcount_ends[__builtin_popcount(extra)]++;
+        }
+
+        // Counting sort, turning counts into starting positions first.
+        size_t start = 0;
+        for (int32_t i = 0; i <= num_free_bits; i++) {
+            size_t count = popcount_ends[i];
+            popcount_ends[i] = start;
+            start += count;
+        }
+
+        std::vector<uint32_t> sorted_extras(extras.size());
+        std::vector<uint32_t> sorted_indices(indices.size());
+        for (size_t i = 0; i < extras.size(); i++) {
+            size_t pos = popcount_ends[__builtin_popcount(extras[i])]++;
+            sorted_extras[pos] = extras[i];
+            sorted_indices[pos] = indices[i];
+        }
+        extras.swap(sorted_extras);
+        indices.swap(sorted_indices);
+    }
+
+public:
+    SupersetIndex(uint32_t target, uint32_t result_mask) :
+        target(target),
+        free_mask(result_mask & ~target),
+        num_free_bits(__builtin_popcount(result_mask & ~target)) {}
+
+    // Returns true iff result has every bit of the target set.
+    bool is_superset(uint32_t result) const {
+        return (result & target) == target;
+    }
+
+    // Add a term to the index if it is a superset of the target.
+    void insert(uint32_t result, uint32_t index) {
+        if (is_superset(result)) {
+            extras.push_back(compress(result, free_mask));
+            indices.push_back(index);
+        }
+    }
+
+    // Must be called after all terms are inserted, and before any queries.
+    // Picks the cheaper of the two lookup strategies, given the number of
+    // queries that will be made.
+    void build(uint64_t num_queries) {
+        uint64_t pairwise_cost = num_queries * extras.size();
+        if (num_free_bits <= SUBSET_TABLE_MAX_BITS
+                && ((uint64_t) num_free_bits << num_free_bits) < pairwise_cost) {
+            build_subset_table();
+        } else {
+            sort_by_popcount();
+        }
+    }
+
+    // Return the bank index of an inserted term b such that (result & b) is
+    // equal to the target, or NOT_FOUND. result must be a superset of the
+    // target.
+    int64_t find_disjoint(uint32_t result) const {
+        uint32_t extra = compress(result, free_mask);
+        uint32_t allowed = ~extra & (uint32_t) ((1ULL << num_free_bits) - 1);
+
+        if (!subset_table.empty()) {
+            uint32_t index = subset_table[allowed];
+            return index == UINT32_MAX ? NOT_FOUND : index;
+        }
+
+        // Two sets of extra bits can only be disjoint if their sizes sum to
+        // at most the number of free bits, so we can skip the larger terms.
+        int32_t max_popcount = num_free_bits - __builtin_popcount(extra);
+        size_t end = popcount_ends[max_popcount];
+        for (size_t i = 0; i < end; i++) {
+            if ((extras[i] & extra) == 0) {
+                return indices[i];
+            }
+        }
+        return NOT_FOUND;
+    }
+};
+
+#endif
@@ -3,14 +3,36 @@
 #ifndef SYNTH_H
 #define SYNTH_H
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "alloc.hpp"
+#include "bank_file.hpp"
+#include "budget.hpp"
+#include "closure.hpp"
 #include "expr.hpp"
+#include "numa.hpp"
+#include "operands.hpp"
+#include "options.hpp"
+#include "perf.hpp"
+#include "progress.hpp"
+#include "result_index.hpp"
 #include "spec.hpp"
+#include "stats.hpp"
+#include "superset_index.hpp"
 #include "timer.hpp"
+#include "trace.hpp"
 
 // The synthesis procedure is organized as a series of passes, where each pass
 // indicates what type of terms are being synthesized, and the height of those
@@ -21,36 +43,50 @@ enum class PassType {
     And,
     Or,
     XorCheck,
+    AndCheck,
+    OrCheck,
     XorSynth
 };
 
+// Result is the type used to store evaluation results, and must have at least
+// spec.num_examples bits. Since the results in the bank are distinct, it is
+// also wide enough for bank indices. Narrower types let small banks use less
+// memory bandwidth and fit in cache.
+template <typename Result>
 class AbstractSynthesizer {
+    // Specs with at most 8 examples are solved by ClosureSynthesizer (see
+    // WidthDispatch), so there is no bank of uint8_t results to compile.
+    static_assert(sizeof(Result) >= 2, "use ClosureSynthesizer for at most 8 examples");
+
 protected:
     // Returned by pass methods when a solution was not found.
     static const int64_t NOT_FOUND = -1;
 
     Spec spec;
 
+    const Options options;
+
     // The maximum number of observationally distinct terms.
     const size_t max_distinct_terms;
 
     // Bitmask indicating which bits contain valid examples.
-    const uint32_t result_mask;
+    const Result result_mask;
+
+    // The evaluation results of the solution.
+    const Result sol_result;
 
     // Number of terms in the bank.
     int64_t num_terms;
 
     // The i'th element stores the evaluation results for the i'th term, where
     // the j'th bit from the right is the evaluation result on example j.
-    uint32_t* const term_results;
+    Result* const term_results;
 
-    // The i'th element is the left child of the i'th term, or the variable
-    // number if the term is a variable.
-    uint32_t* const term_lefts;
-
-    // The i'th element is the right child of the i'th term, or undefined if
-    // the term is a variable or a NOT.
-    uint32_t* const term_rights;
+    // The i'th element holds the operands of the terms added in the i'th
+    // pass: the left child, or the variable number if the term is a
+    // variable, and the right child of binary operator terms. The last
+    // element belongs to the pass in progress.
+    std::vector<TermOperands> pass_operands;
 
     // The i'th element is the size of the bank when the i'th pass started,
     // or equivalently, the index of the first element in the i'th pass.
@@ -66,16 +102,61 @@ protected:
     // The type of the i'th pass.
     std::vector<PassType> pass_types;
 
-    AbstractSynthesizer(Spec spec) :
+    // Maps results to bank indices, for the terms of every completed pass.
+    ResultIndex result_index;
+
+    // Work counted by the pass kernels during the pass in progress, in one
+    // slot per thread or shard (see stats.hpp).
+    PassCounterSlots counter_slots;
+
+    // Records the timeline, or nullptr if it isn't traced (see trace.hpp).
+    Tracer* const tracer;
+
+    // The bytes of the operands of every completed pass, which the memory
+    // budget charges (see estimated_bytes).
+    uint64_t operand_bytes;
+
+    // Tiles done by the pass in progress, or nullptr if progress isn't
+    // reported. Shared with the shards, like the counter slots.
+    int64_t* const tiles_done;
+
+    AbstractSynthesizer(Spec spec, const Options &options, size_t num_counter_slots = 1) :
             spec(spec),
+            options(start_budget(options)),
             max_distinct_terms(1ULL << spec.num_examples),
             result_mask(max_distinct_terms - 1),
+            sol_result(spec.sol_result),
             num_terms(0),
-            term_results((uint32_t*) alloc(max_distinct_terms * sizeof(uint32_t))),
-            term_lefts((uint32_t*) alloc(max_distinct_terms * sizeof(uint32_t))),
-            term_rights((uint32_t*) alloc(max_distinct_terms * sizeof(uint32_t))) {
+            term_results((Result*) alloc_spilled(max_distinct_terms * sizeof(Result),
+                        options.spill_dir, options.shards > 1)),
+            result_index(max_distinct_terms),
+            counter_slots(num_counter_slots, options.shards > 1),
+            tracer(Tracer::start(options.trace_path)),
+            operand_bytes(0),
+            tiles_done(options.progress_ms == 0 ? nullptr : (int64_t*)
+                    (options.shards > 1 ? alloc_shared(sizeof(int64_t)) : alloc(sizeof(int64_t)))),
+            tiles_begin(0),
+            tiles_end(INT64_MAX),
+            pass_tiles(0),
+            started(false),
+            finished(false),
+            next_pass(0),
+            next_tile(0),
+            num_restored_passes(0),
+            bank_file_passes(0),
+            bank_file_end(0),
+            bank_file_size(0),
+            exceeded_limit(BudgetLimit::None),
+            pass_running(false),
+            progress_num_tiles(0),
+            sol_index(NOT_FOUND),
+            solution_expr(nullptr),
+            synth_ms(0),
+            pass_ns(0),
+            pass_prev_num_terms(0) {
         // Ensure that the bits outside the mask are always 0.
         // TODO: move this and max_distinct_terms to the Spec constructor?
+        assert(spec.num_examples <= 8 * sizeof(Result));
         assert((spec.sol_result & ~result_mask) == 0);
         for (int64_t i = 0; i < spec.num_vars; i++) {
             assert((spec.var_values[i] & ~result_mask) == 0);
@@ -83,9 +164,167 @@ protected:
     }
 
     ~AbstractSynthesizer() {
-        dealloc(term_results, max_distinct_terms * sizeof(uint32_t));
-        dealloc(term_lefts, max_distinct_terms * sizeof(uint32_t));
-        dealloc(term_rights, max_distinct_terms * sizeof(uint32_t));
+        reporter.reset();
+        if (tiles_done != nullptr) {
+            dealloc(tiles_done, sizeof(int64_t));
+        }
+        dealloc(term_results, max_distinct_terms * sizeof(Result));
+        for (TermOperands &operands : pass_operands) {
+            operands.release();
+        }
+    }
+
+    // Whether operands may be stored in fewer than 32 bits (see
+    // TermOperands). Variants whose kernels write operands directly can turn
+    // this off.
+    virtual bool narrow_operands() {
+        return true;
+    }
+
+    // How the binary passes read the terms below height `height - 1`, which
+    // is passed to the kernel as a hint if the bank is spilled. By default,
+    // they are read again for every right operand, so they should stay in
+    // memory. Variants that read each of them once per pass can return
+    // Access::Sequential.
+    virtual Access lower_terms_access() {
+        return Access::WillNeed;
+    }
+
+    // Called every time a pass is started, to set up storage for the operands
+    // of the new terms.
+    void begin_pass(PassType type, int32_t height) {
+        int64_t prevs_start = terms_with_height_start(height - 1);
+        int64_t prevs_end = terms_with_height_end(height - 1);
+
+        // The results of new terms are distinct from the existing ones, which
+        // bounds the number of new terms regardless of the pass.
+        int64_t capacity = max_distinct_terms - num_terms;
+        int64_t lefts_start = 0, lefts_end = 0;
+        int64_t rights_start = 0, rights_end = 0;
+        switch (type) {
+            case PassType::Variable:
+                lefts_end = spec.num_vars;
+                break;
+            case PassType::Not:
+                lefts_start = prevs_start;
+                lefts_end = prevs_end;
+                break;
+            case PassType::And:
+            case PassType::Or:
+            case PassType::XorSynth:
+                // Any term of lower height can be the left operand, and the
+                // right operand has height `height - 1`.
+                lefts_end = prevs_end;
+                rights_start = prevs_start;
+                rights_end = prevs_end;
+                break;
+            case PassType::XorCheck:
+            case PassType::AndCheck:
+            case PassType::OrCheck:
+                // At most one term, the solution, whose operands can be any
+                // term.
+                capacity = std::min(capacity, (int64_t) 1);
+                lefts_end = num_terms;
+                rights_end = num_terms;
+                break;
+        }
+
+        // No pass adds more terms than it has operand pairs. Binary passes
+        // only pair each right operand with the left operands up to it (see
+        // trapezoid_tile). Bank indices are below 2^32, so this can't
+        // overflow. Check passes have no pairs if either side is empty.
+        uint64_t pairs = lefts_end - lefts_start;
+        uint64_t rights = rights_end - rights_start;
+        if (type == PassType::And || type == PassType::Or || type == PassType::XorSynth) {
+            pairs = (uint64_t) rights_start * rights + rights * (rights + 1) / 2;
+        } else if (type != PassType::Variable && type != PassType::Not && rights == 0) {
+            pairs = 0;
+        }
+        capacity = std::min((uint64_t) capacity, pairs);
+
+        if (options.max_memory_bytes > 0
+                && estimated_bytes(num_terms + capacity) > options.max_memory_bytes) {
+            *options.log << "\tmay exceed the memory budget, with up to " << capacity
+                << " new term(s)" << std::endl;
+        }
+
+        pass_operands.push_back(TermOperands(capacity, lefts_start, lefts_end,
+                    rights_start, rights_end, narrow_operands(), options.spill_dir,
+                    options.shards > 1));
+
+        if (spilled()) {
+            // Terms of height `height - 1` are read over and over, and the
+            // binary passes also read the lower terms (see
+            // lower_terms_access).
+            advise(&term_results[prevs_start], (prevs_end - prevs_start) * sizeof(Result),
+                    Access::WillNeed);
+            if (rights_end > rights_start) {
+                advise(term_results, prevs_start * sizeof(Result), lower_terms_access());
+            }
+        }
+    }
+
+    // The NUMA node of each worker thread, or -1 for threads that aren't
+    // pinned, for the placement report (see numa.hpp).
+    virtual std::vector<int32_t> thread_nodes() {
+        return {};
+    }
+
+    // The threads that run passes, for hardware counters (see perf.hpp).
+    virtual std::vector<pid_t> worker_threads() {
+        return {current_thread_id()};
+    }
+
+    // The number of terms in the bank, including those added so far by the
+    // pass in progress on other threads.
+    virtual int64_t current_num_terms() {
+        return num_terms;
+    }
+
+    // An upper bound on the memory that this synthesizer allocates for a
+    // bank with the given number of terms, which the memory budget is
+    // charged: the seen bitset, whose pages are all touched sooner or later,
+    // a result for each term, the operands and the result index of the
+    // completed passes, and for each term added since, two operands of at
+    // most 32 bits and its share of the index.
+    // Other memory of the process, such as other jobs or pooled regions
+    // (see RegionPool), isn't charged.
+    uint64_t estimated_bytes(int64_t terms) {
+        int64_t new_terms = std::max(terms - current_pass_start(), (int64_t) 0);
+        return CEIL_DIV(max_distinct_terms, 8) + result_index.bytes()
+            + terms * sizeof(Result) + operand_bytes + new_terms * 2 * sizeof(uint32_t)
+            + result_index.update_bytes(new_terms);
+    }
+
+    // Whether the bank is backed by files (see Options::spill_dir).
+    bool spilled() {
+        return !options.spill_dir.empty();
+    }
+
+    // Start reading in the results of the given terms, if the bank is
+    // spilled.
+    void prefetch_terms(int64_t start, int64_t count) {
+        if (spilled() && start < num_terms) {
+            count = std::min(count, num_terms - start);
+            advise(&term_results[start], count * sizeof(Result), Access::WillNeed);
+        }
+    }
+
+    // Index of the first term added by the pass in progress.
+    int64_t current_pass_start() {
+        return pass_ends.empty() ? 0 : pass_ends.back();
+    }
+
+    // Set the operands of count terms starting at the given index, which were
+    // added by the pass in progress. rights is ignored for unary terms.
+    template <typename Index>
+    void store_operands(int64_t index, int64_t count, const Index* lefts,
+            const Index* rights) {
+        pass_operands.back().store(index - current_pass_start(), count, lefts, rights);
+    }
+
+    void store_operands(int64_t index, uint32_t left, uint32_t right) {
+        store_operands(index, 1, &left, &right);
     }
 
     // Called every time a pass is completed.
@@ -94,76 +333,368 @@ protected:
         pass_ends.push_back(num_terms);
         pass_heights.push_back(height);
         pass_types.push_back(type);
+        result_index.update(term_results, num_terms);
+        int64_t count = pass_ends.back() - pass_starts.back();
+        operand_bytes += pass_operands.back().left_bytes(count)
+            + pass_operands.back().right_bytes(count);
+
+        if (spilled()) {
+            pass_operands.back().advise_done();
+        }
+    }
+
+    // Return the pass in which the term at the given index was added.
+    size_t pass_of(int64_t index) {
+        // pass_ends is sorted, so find the first pass that ends after index.
+        auto it = std::upper_bound(pass_ends.begin(), pass_ends.end(), index);
+        assert(it != pass_ends.end());
+        return it - pass_ends.begin();
     }
 
     // Reconstruct the term at the given index in the bank.
-    const Expr* reconstruct(int64_t index) {
+    const Expr* reconstruct(int64_t index,
+            std::unordered_map<int64_t, const Expr*> &memo) {
         assert(0 <= index && index < num_terms);
 
-        size_t pass = 0;
-        while (true) {
-            assert(pass < pass_ends.size());
-            if (index < pass_ends[pass]) {
-                break;
-            }
-            pass++;
+        auto it = memo.find(index);
+        if (it != memo.end()) {
+            return it->second;
         }
 
+        size_t pass = pass_of(index);
+        const TermOperands &operands = pass_operands[pass];
+        int64_t pos = index - pass_starts[pass];
+        uint32_t left = operands.left(pos);
+        uint32_t right = operands.has_right() ? operands.right(pos) : 0;
+
+        const Expr* expr = nullptr;
         switch (pass_types[pass]) {
             case PassType::Variable:
-                return Expr::Var(term_lefts[index]);
+                expr = Expr::Var(left);
+                break;
             case PassType::Not:
-                return Expr::Not(reconstruct(term_lefts[index]));
+                expr = Expr::Not(reconstruct(left, memo));
+                break;
             case PassType::And:
-                return Expr::And(
-                        reconstruct(term_lefts[index]),
-                        reconstruct(term_rights[index]));
+            case PassType::AndCheck:
+                expr = Expr::And(
+                        reconstruct(left, memo),
+                        reconstruct(right, memo));
+                break;
             case PassType::Or:
-                return Expr::Or(
-                        reconstruct(term_lefts[index]),
-                        reconstruct(term_rights[index]));
+            case PassType::OrCheck:
+                expr = Expr::Or(
+                        reconstruct(left, memo),
+                        reconstruct(right, memo));
+                break;
             case PassType::XorCheck:
             case PassType::XorSynth:
-                return Expr::Xor(
-                        reconstruct(term_lefts[index]),
-                        reconstruct(term_rights[index]));
+                expr = Expr::Xor(
+                        reconstruct(left, memo),
+                        reconstruct(right, memo));
+                break;
         }
 
-        assert(false);
-        return nullptr;
+        assert(expr != nullptr);
+        memo[index] = expr;
+        return expr;
     }
 
-    // Return the index of the first term with the given height.
+    // Build the expression for a term. Terms used more than once are only
+    // reconstructed once, and share the same Expr.
+    const Expr* reconstruct(int64_t index) {
+        std::unordered_map<int64_t, const Expr*> memo;
+        return reconstruct(index, memo);
+    }
+
+    // Return the index of the first term with the given height, or 0 if there
+    // are no passes with that height.
     int64_t terms_with_height_start(int32_t height) {
-        int64_t index = 0;
-        for (size_t i = 0; i < pass_types.size(); i++) {
-            if (pass_heights[i] == height) {
-                index = pass_starts[i];
-                break;
-            }
+        // Passes are recorded in order of increasing height.
+        auto it = std::lower_bound(pass_heights.begin(), pass_heights.end(), height);
+        if (it == pass_heights.end() || *it != height) {
+            return 0;
         }
-        return index;
+        return pass_starts[it - pass_heights.begin()];
     }
 
-    // Return the index after the last term with the given height.
+    // Return the index after the last term with the given height, or 0 if
+    // there are no passes with that height.
     int64_t terms_with_height_end(int32_t height) {
-        int64_t index = 0;
-        for (size_t i = 0; i < pass_types.size(); i++) {
-            if (pass_heights[i] == height) {
-                index = pass_ends[i];
+        auto it = std::upper_bound(pass_heights.begin(), pass_heights.end(), height);
+        if (it == pass_heights.begin() || *(it - 1) != height) {
+            return 0;
+        }
+        return pass_ends[it - pass_heights.begin() - 1];
+    }
+
+    // The bytes of the bitset of results in the bank (see BaseBitset), or
+    // nullptr if the bitset can't be accessed directly.
+    virtual uint8_t* seen_bytes() {
+        return nullptr;
+    }
+
+    // Whether the bank is checkpointed to a bank file. This needs direct
+    // access to the seen bitset.
+    bool persistent() {
+        return !options.bank_dir.empty() && seen_bytes() != nullptr;
+    }
+
+    std::string bank_path() {
+        return options.bank_dir + "/" + bank_file_name(spec.num_examples,
+                sizeof(Result), spec.num_vars, spec.var_values, spec.var_heights);
+    }
+
+    // Append the passes completed since the last checkpoint to the bank file
+    // (see bank_file.hpp).
+    void save_bank() {
+        if (bank_file_size == SIZE_MAX) {
+            return;
+        }
+        std::string path = bank_path();
+        BankFileAppender appender(path);
+        size_t size = appender.size();
+        if (size != bank_file_size) {
+            // Errors opening the file were already reported.
+            if (size != SIZE_MAX) {
+                *options.log << "Not checkpointing to " << path
+                    << ": it was written by another run" << std::endl;
+            }
+            bank_file_size = SIZE_MAX;
+            return;
+        }
+
+        // Anything after the passes of this run, such as the check passes of
+        // another target, or a pass that was being written when a run
+        // stopped, is replaced.
+        appender.truncate(bank_file_end);
+        appender.align();
+        if (bank_file_end == 0) {
+            BankFileHeader header = {};
+            memcpy(header.magic, BANK_FILE_MAGIC, sizeof(header.magic));
+            header.version = BANK_FILE_VERSION;
+            header.result_size = sizeof(Result);
+            header.num_examples = spec.num_examples;
+            header.num_vars = spec.num_vars;
+            appender.write(&header, sizeof(header));
+            appender.write(spec.var_values.data(), spec.num_vars * sizeof(uint32_t));
+            appender.write(spec.var_heights.data(), spec.num_vars * sizeof(int32_t));
+            appender.align();
+        }
+
+        for (size_t i = bank_file_passes; i < pass_types.size(); i++) {
+            int64_t count = pass_ends[i] - pass_starts[i];
+            BankFilePass pass = {
+                pass_starts[i],
+                pass_ends[i],
+                pass_heights[i],
+                (int32_t) pass_types[i],
+                pass_operands[i].layout(),
+                spec.sol_result,
+                spec.sol_height
+            };
+            appender.write(&pass, sizeof(pass));
+            appender.align();
+            appender.write(&term_results[pass_starts[i]], count * sizeof(Result));
+            appender.align();
+            appender.write(pass_operands[i].left_data(), pass_operands[i].left_bytes(count));
+            appender.align();
+            appender.write(pass_operands[i].right_data(), pass_operands[i].right_bytes(count));
+            appender.align();
+        }
+
+        if (!appender.commit()) {
+            bank_file_size = SIZE_MAX;
+            return;
+        }
+        bank_file_passes = pass_types.size();
+        bank_file_end = appender.end();
+        bank_file_size = appender.end();
+        evict_lru(options.bank_dir, "bank-", ".bin", options.bank_max_bytes, path);
+    }
+
+    // Restore the bank from the bank file, if there is one, and return the
+    // number of restored passes. Passes that were run for the same target are
+    // all restored, and synthesis continues with the next one. The check
+    // passes of other targets don't apply to this one, so otherwise, we only
+    // restore the heights below spec.sol_height whose terms were all
+    // enumerated; if the target is reachable at those heights, it is already
+    // in the bank.
+    size_t load_bank() {
+        std::string path = bank_path();
+        BankFileReader reader(path);
+        if (!reader.is_open()) {
+            return 0;
+        }
+        // Until passes are restored, the file is replaced by the first
+        // checkpoint.
+        bank_file_size = reader.file_size();
+
+        const BankFileHeader* header =
+            (const BankFileHeader*) reader.read(sizeof(BankFileHeader));
+        const uint32_t* var_values = header == nullptr ? nullptr
+            : (const uint32_t*) reader.read(spec.num_vars * sizeof(uint32_t));
+        const int32_t* var_heights = var_values == nullptr ? nullptr
+            : (const int32_t*) reader.read(spec.num_vars * sizeof(int32_t));
+        if (var_heights == nullptr
+                || memcmp(header->magic, BANK_FILE_MAGIC, sizeof(header->magic)) != 0
+                || header->version != BANK_FILE_VERSION
+                || header->result_size != sizeof(Result)
+                || header->num_examples != spec.num_examples
+                || header->num_vars != spec.num_vars
+                || memcmp(var_values, spec.var_values.data(), spec.num_vars * sizeof(uint32_t)) != 0
+                || memcmp(var_heights, spec.var_heights.data(), spec.num_vars * sizeof(int32_t)) != 0) {
+            *options.log << "Ignoring bank file " << path << ": header doesn't match" << std::endl;
+            return 0;
+        }
+        reader.align();
+
+        // Read passes up to the end of the file, or up to the first one that
+        // is truncated or invalid.
+        struct FilePass {
+            const BankFilePass* pass;
+            const Result* results;
+            const uint8_t* left;
+            const uint8_t* right;
+            size_t end;
+        };
+        std::vector<FilePass> passes;
+        while (reader.position() < reader.file_size()) {
+            const BankFilePass* pass = (const BankFilePass*) reader.read(sizeof(BankFilePass));
+            if (pass == nullptr) {
+                break;
+            }
+            const TermOperands::Layout &layout = pass->layout;
+            bool valid_widths = (layout.left_width == 1 || layout.left_width == 2
+                    || layout.left_width == 4)
+                && (layout.right_width == 0 || layout.right_width == 1
+                    || layout.right_width == 2 || layout.right_width == 4);
+            // Passes are run in the order of the schedule, which is the same
+            // for every target below its height. Passes of other targets from
+            // spec.sol_height on can't be restored, so reading stops there,
+            // and a pass below it that doesn't match the schedule is invalid.
+            size_t index = passes.size();
+            bool scheduled = index < schedule.size()
+                && pass->height == schedule[index].first
+                && pass->type == (int32_t) schedule[index].second;
+            if (!scheduled && pass->height >= spec.sol_height) {
+                break;
+            }
+            bool binary = pass->type != (int32_t) PassType::Variable
+                && pass->type != (int32_t) PassType::Not;
+            if (!scheduled
+                    || pass->start != (passes.empty() ? 0 : passes.back().pass->end)
+                    || pass->end < pass->start
+                    || (size_t) pass->end > max_distinct_terms
+                    || !valid_widths || (layout.right_width != 0) != binary) {
+                *options.log << "Ignoring bank file " << path << " from pass "
+                    << index << ": invalid pass" << std::endl;
+                break;
+            }
+
+            int64_t count = pass->end - pass->start;
+            reader.align();
+            const Result* results = (const Result*) reader.read(count * sizeof(Result));
+            reader.align();
+            const uint8_t* left = (const uint8_t*) reader.read(count * layout.left_width);
+            reader.align();
+            const uint8_t* right = (const uint8_t*) reader.read(count * layout.right_width);
+            reader.align();
+            if (results == nullptr || left == nullptr || right == nullptr) {
+                break;
+            }
+
+            // Results are indices into seen and the result index, and
+            // reconstruct follows operands, so both must be in range.
+            // Operands are earlier terms, or variables in the variable pass.
+            uint64_t operand_end = pass->type == (int32_t) PassType::Variable
+                ? spec.num_vars : pass->start;
+            bool valid_results = std::all_of(results, results + count,
+                    [&](Result result) { return (result & ~result_mask) == 0; });
+            if (!valid_results
+                    || !TermOperands::all_below(left, layout.left_width,
+                        layout.left_base, count, operand_end)
+                    || !TermOperands::all_below(right, layout.right_width,
+                        layout.right_base, count, operand_end)) {
+                *options.log << "Ignoring bank file " << path << " from pass "
+                    << index << ": terms out of range" << std::endl;
+                break;
+            }
+            passes.push_back({pass, results, left, right, reader.position()});
+        }
+
+        size_t num_passes = 0;
+        while (num_passes < passes.size()
+                && passes[num_passes].pass->sol_result == spec.sol_result
+                && passes[num_passes].pass->sol_height == spec.sol_height) {
+            num_passes++;
+        }
+        for (size_t i = 0; i < passes.size(); i++) {
+            const BankFilePass &pass = *passes[i].pass;
+            PassType type = (PassType) pass.type;
+            if (pass.height >= spec.sol_height) {
+                break;
             }
+            // These are the last passes of their heights.
+            if ((pass.height == 0 && type == PassType::Variable)
+                    || type == PassType::XorSynth) {
+                num_passes = std::max(num_passes, i + 1);
+            }
+        }
+        if (num_passes == 0) {
+            return 0;
         }
-        return index;
+
+        num_terms = passes[num_passes - 1].pass->end;
+        for (size_t i = 0; i < num_passes; i++) {
+            const BankFilePass &pass = *passes[i].pass;
+            int64_t count = pass.end - pass.start;
+            memcpy(&term_results[pass.start], passes[i].results, count * sizeof(Result));
+            TermOperands operands(count, pass.layout, options.spill_dir,
+                    options.shards > 1);
+            memcpy(operands.left_data(), passes[i].left, operands.left_bytes(count));
+            if (operands.has_right()) {
+                memcpy(operands.right_data(), passes[i].right, operands.right_bytes(count));
+            }
+            pass_operands.push_back(operands);
+            operand_bytes += operands.left_bytes(count) + operands.right_bytes(count);
+            pass_starts.push_back(pass.start);
+            pass_ends.push_back(pass.end);
+            pass_heights.push_back(pass.height);
+            pass_types.push_back((PassType) pass.type);
+            result_index.update(term_results, pass.end);
+        }
+
+        uint8_t* seen = seen_bytes();
+        for (int64_t i = 0; i < num_terms; i++) {
+            seen[term_results[i] / 8] |= 1 << (term_results[i] % 8);
+        }
+
+        bank_file_passes = num_passes;
+        bank_file_end = passes[num_passes - 1].end;
+
+        // Mark the file as recently used (see evict_lru).
+        std::error_code error;
+        std::filesystem::last_write_time(path,
+                std::filesystem::file_time_type::clock::now(), error);
+
+        *options.log << "Restored " << num_passes << " pass(es) and " << num_terms
+            << " term(s) from " << path << std::endl;
+        return num_passes;
     }
 
-    // Return the index of the term with the given result.
+    // Return the index of the term with the given result, which must be in
+    // the bank.
     uint32_t find_term_with_result(uint32_t result) {
-        // In a multithreaded environment, num_terms might get updated during
-        // the execution of the following loop. However, if a term with the
-        // specified result is present in the bank when this method is called,
-        // we don't need to consider terms that are added concurrently.
+        int64_t index = result_index.find(result, term_results);
+        if (index != ResultIndex::NOT_FOUND) {
+            return index;
+        }
+
+        // The terms added by the pass in progress aren't indexed until it
+        // ends, so scan them.
         int64_t end = num_terms;
-        for (int64_t i = 0; i < end; i++) {
+        for (int64_t i = result_index.end(); i < end; i++) {
             if (term_results[i] == result) {
                 return i;
             }
@@ -174,70 +705,593 @@ protected:
         return 0;
     }
 
+    // Look for a pair of terms whose AND (if flip is 0) or OR (if flip is
+    // result_mask) is the solution, where the right operand has height
+    // `height - 1` and the left operand has a height less than `height`. These
+    // are exactly the pairs that the And or Or pass would consider, but we
+    // only look at terms that can possibly be operands: for AND, both operands
+    // must be supersets of the solution. OR is handled as an AND of the
+    // complemented results.
+    bool find_check_pair(int32_t height, uint32_t flip, uint32_t &left, uint32_t &right) {
+        int64_t rights_start = terms_with_height_start(height - 1);
+        int64_t rights_end = terms_with_height_end(height - 1);
+
+        SupersetIndex index(spec.sol_result ^ flip, result_mask);
+        uint64_t num_queries = 0;
+        for (int64_t i = 0; i < rights_end; i++) {
+            uint32_t result = term_results[i] ^ flip;
+            index.insert(result, i);
+            if (i >= rights_start && index.is_superset(result)) {
+                num_queries++;
+            }
+        }
+
+        index.build(num_queries);
+
+        for (int64_t i = rights_start; i < rights_end; i++) {
+            uint32_t result = term_results[i] ^ flip;
+            if (!index.is_superset(result)) {
+                continue;
+            }
+
+            int64_t other = index.find_disjoint(result);
+            if (other != SupersetIndex::NOT_FOUND) {
+                left = other;
+                right = i;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Remember that the given budget was exceeded, unless another one was
+    // first, and return true.
+    bool exceed(BudgetLimit limit) {
+        BudgetLimit none = BudgetLimit::None;
+        exceeded_limit.compare_exchange_strong(none, limit, std::memory_order_relaxed);
+        return true;
+    }
+
+    // The first budget that was exceeded, or BudgetLimit::None.
+    BudgetLimit exceeded_budget() {
+        return exceeded_limit.load(std::memory_order_relaxed);
+    }
+
+    // Whether a budget of options has been exceeded (see budget.hpp).
+    bool over_budget() {
+        if (exceeded_limit.load(std::memory_order_relaxed) != BudgetLimit::None) {
+            return true;
+        }
+        if (options.deadline != std::chrono::steady_clock::time_point::max()
+                && std::chrono::steady_clock::now() >= options.deadline) {
+            return exceed(BudgetLimit::Time);
+        }
+        if (options.max_terms > 0 || options.max_memory_bytes > 0) {
+            int64_t terms = current_num_terms();
+            if (options.max_terms > 0 && terms > options.max_terms) {
+                return exceed(BudgetLimit::Terms);
+            }
+            if (options.max_memory_bytes > 0
+                    && estimated_bytes(terms) > options.max_memory_bytes) {
+                return exceed(BudgetLimit::Memory);
+            }
+        }
+        return false;
+    }
+
+    // Whether synthesis should stop before it is done, because it was
+    // cancelled (see Options::cancel) or is over budget. Passes check this
+    // between tiles, and return NOT_FOUND early if it is true.
+    bool stop_requested() {
+        return (options.cancel != nullptr && options.cancel->load(std::memory_order_relaxed))
+            || over_budget();
+    }
+
     virtual int64_t pass_Variable(int32_t height) = 0;
     virtual int64_t pass_Not(int32_t height) = 0;
     virtual int64_t pass_And(int32_t height) = 0;
     virtual int64_t pass_Or(int32_t height) = 0;
     virtual int64_t pass_XorCheck(int32_t height) = 0;
+    virtual int64_t pass_AndCheck(int32_t height) = 0;
+    virtual int64_t pass_OrCheck(int32_t height) = 0;
     virtual int64_t pass_XorSynth(int32_t height) = 0;
 
-public:
-    // Return an Expr satisfying spec, or nullptr if it cannot be found.
-    const Expr* synthesize() {
-        int64_t sol_index = NOT_FOUND;
-        Timer timer;
-
-        for (int32_t height = 0; height <= spec.sol_height; height++) {
-
-// Do the specified pass, and break out of the loop if a solution was found.
-#define DO_PASS(TYPE)                       \
-{                                           \
-    int64_t prev_num_terms = num_terms;     \
-    std::cerr << "height " << height        \
-        << ", " #TYPE " pass" << std::endl; \
-                                            \
-    Timer pass_timer;                       \
-    sol_index = pass_ ## TYPE(height);      \
-    uint64_t ms = pass_timer.ms();          \
-    record_pass(PassType::TYPE, height);    \
-                                            \
-    std::cerr << "\t" << ms << " ms, "      \
-        << (num_terms - prev_num_terms) << " new term(s), " \
-        << num_terms << " total term(s)"    \
-        << std::endl;                       \
-                                            \
-    if (sol_index != NOT_FOUND) {           \
-        break;                              \
-    }                                       \
-}
-
-            DO_PASS(Variable);
-
-            // The subsequent passes look for terms in the bank whose height is
-            // one less. When the height is 0, we should skip them.
-            if (height == 0) {
-                continue;
+    // The part of the pass in progress that the pass methods should do (see
+    // step). The And, Or and XorSynth passes are divided into tiles, do only
+    // the tiles in [tiles_begin, tiles_end), and set pass_tiles to the number
+    // of tiles in the pass, so that a later call can continue where they
+    // left off. Variants may also do a whole binary pass at once, and leave
+    // pass_tiles at 0. Other passes do all of their work in one call.
+    int64_t tiles_begin;
+    int64_t tiles_end;
+    int64_t pass_tiles;
+
+    // Called by the passes after every tile, to report progress.
+    void count_tile() {
+        if (tiles_done != nullptr) {
+            __atomic_fetch_add(tiles_done, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Set begin and end to the range of tiles that the pass should do, given
+    // its number of tiles.
+    void tile_range(int64_t num_tiles, int64_t &begin, int64_t &end) {
+        pass_tiles = num_tiles;
+        progress_num_tiles.store(num_tiles, std::memory_order_relaxed);
+        begin = std::min(tiles_begin, num_tiles);
+        end = std::min(tiles_end, num_tiles);
+    }
+
+private:
+    // The passes in the order that they are run, as (height, type) pairs.
+    // The check passes run before the variables of each height are added,
+    // since XorCheck may pair a term with any result in the bank, and that
+    // result must have a lower height. And, Or and XorSynth only run below
+    // the solution height, since the check passes have already considered
+    // every AND, OR, and XOR of that height.
+    std::vector<std::pair<int32_t, PassType>> schedule;
+
+    // State of step: whether synthesis has started and finished, the index
+    // in schedule of the pass in progress, and its next tile.
+    bool started;
+    bool finished;
+    size_t next_pass;
+    int64_t next_tile;
+
+    // Passes restored from the bank file, which are skipped.
+    size_t num_restored_passes;
+
+    // The number of passes in the bank file that were restored or saved by
+    // this synthesizer, the offset after the last of them, and the size of
+    // the file when it was last read or written, or SIZE_MAX once
+    // checkpoints have failed. The file is only appended to while it has
+    // that size, since otherwise another run has written it since.
+    size_t bank_file_passes;
+    size_t bank_file_end;
+    size_t bank_file_size;
+
+    // The first budget that was exceeded, and the status reported for it
+    // once synthesis has stopped.
+    std::atomic<BudgetLimit> exceeded_limit;
+    BudgetStatus budget;
+
+    // Reports progress every options.progress_ms, if that isn't 0. The
+    // reporter only writes to the log while pass_running is set, during which
+    // nothing else does, and progress_mutex guards pass_running.
+    std::mutex progress_mutex;
+    bool pass_running;
+    std::chrono::steady_clock::time_point pass_begin;
+    std::atomic<int64_t> progress_num_tiles;
+    std::unique_ptr<ProgressReporter> reporter;
+
+    // Hardware counters of the threads that were running passes when
+    // synthesis started, or nullptr if they aren't counted.
+    std::unique_ptr<PerfCounters> perf;
+
+    // The bank index of the solution, and the solution once finished.
+    int64_t sol_index;
+    const Expr* solution_expr;
+
+    // Time spent in step calls, in total and in the pass in progress, and the
+    // number of terms when that pass started.
+    uint64_t synth_ms;
+    uint64_t pass_ns;
+    int64_t pass_prev_num_terms;
+
+    static const char* pass_type_name(PassType type) {
+        switch (type) {
+            case PassType::Variable: return "Variable";
+            case PassType::Not: return "Not";
+            case PassType::And: return "And";
+            case PassType::Or: return "Or";
+            case PassType::XorCheck: return "XorCheck";
+            case PassType::AndCheck: return "AndCheck";
+            case PassType::OrCheck: return "OrCheck";
+            case PassType::XorSynth: return "XorSynth";
+        }
+        return "";
+    }
+
+    int64_t run_pass(PassType type, int32_t height) {
+        switch (type) {
+            case PassType::Variable: return pass_Variable(height);
+            case PassType::Not: return pass_Not(height);
+            case PassType::And: return pass_And(height);
+            case PassType::Or: return pass_Or(height);
+            case PassType::XorCheck: return pass_XorCheck(height);
+            case PassType::AndCheck: return pass_AndCheck(height);
+            case PassType::OrCheck: return pass_OrCheck(height);
+            case PassType::XorSynth: return pass_XorSynth(height);
+        }
+        return NOT_FOUND;
+    }
+
+    // Set whether the pass in progress is running.
+    void set_pass_running(bool running) {
+        if (reporter != nullptr) {
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            pass_running = running;
+        }
+    }
+
+    // Called by the reporter.
+    void report_progress() {
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        if (!pass_running) {
+            return;
+        }
+
+        auto [height, type] = schedule[next_pass];
+        uint64_t elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - pass_begin).count();
+        Progress progress = {};
+        progress.height = height;
+        progress.pass = pass_type_name(type);
+        progress.num_tiles = progress_num_tiles.load(std::memory_order_relaxed);
+        progress.tiles_done = std::min(__atomic_load_n(tiles_done, __ATOMIC_RELAXED),
+                progress.num_tiles);
+        progress.num_terms = current_num_terms();
+        progress.new_terms = progress.num_terms - pass_prev_num_terms;
+        progress.elapsed_ms = elapsed_ns / 1000000;
+        progress.terms_per_second = elapsed_ns > 0 ? progress.new_terms * 1e9 / elapsed_ns : 0;
+        progress.pass_eta_ms = -1;
+        progress.height_eta_ms = -1;
+        if (progress.tiles_done > 0) {
+            // The And, Or and XorSynth passes of a height have the same
+            // operands, and so the same number of tiles.
+            double pass_ms = elapsed_ns / 1e6 * progress.num_tiles / progress.tiles_done;
+            int64_t binary_passes_left = 0;
+            for (size_t i = next_pass + 1; i < schedule.size() && schedule[i].first == height; i++) {
+                PassType later = schedule[i].second;
+                binary_passes_left += later == PassType::And || later == PassType::Or
+                    || later == PassType::XorSynth;
             }
+            progress.pass_eta_ms = pass_ms - progress.elapsed_ms;
+            progress.height_eta_ms = progress.pass_eta_ms + binary_passes_left * pass_ms;
+        }
 
-            DO_PASS(XorCheck);
-            DO_PASS(Not);
+        *options.log << "\t";
+        progress.print(*options.log);
+        *options.log << std::endl;
+        if (options.on_progress) {
+            options.on_progress(progress);
+        }
+    }
 
-            DO_PASS(And);
-            DO_PASS(Or);
+    void start() {
+        started = true;
+        if (spilled()) {
+            *options.log << "Spilling bank to " << options.spill_dir << std::endl;
+        }
 
-            // Only synthesize new terms if we need them for the next iteration.
+        schedule.push_back({0, PassType::Variable});
+        for (int32_t height = 1; height <= spec.sol_height; height++) {
+            for (PassType type : {PassType::XorCheck, PassType::AndCheck, PassType::OrCheck,
+                    PassType::Variable, PassType::Not}) {
+                schedule.push_back({height, type});
+            }
             if (height < spec.sol_height) {
-                DO_PASS(XorSynth);
+                for (PassType type : {PassType::And, PassType::Or, PassType::XorSynth}) {
+                    schedule.push_back({height, type});
+                }
             }
+        }
 
-#undef DO_PASS
+        if (options.perf) {
+            std::string error;
+            perf = std::make_unique<PerfCounters>(worker_threads(), error);
+            if (!perf->available()) {
+                // CEGIS starts a synthesizer per iteration, so this is only
+                // reported once.
+                static std::atomic<bool> reported(false);
+                if (!reported.exchange(true)) {
+                    *options.log << "Hardware counters unavailable (" << error
+                        << "), continuing without them" << std::endl;
+                }
+                perf.reset();
+            }
         }
 
-        uint64_t ms = timer.ms();
-        std::cerr << ms << " ms, "
+        if (options.max_memory_bytes > 0) {
+            // The seen bitset is needed however few terms there are, so a
+            // budget that can't hold it is exceeded before the first pass.
+            if (estimated_bytes(max_distinct_terms) > options.max_memory_bytes) {
+                *options.log << "Memory estimate: " << estimated_bytes(0) / (1 << 20)
+                    << " MB to " << estimated_bytes(max_distinct_terms) / (1 << 20)
+                    << " MB, over the budget of " << options.max_memory_bytes / (1 << 20)
+                    << " MB" << std::endl;
+            }
+        }
+
+        if (options.progress_ms > 0) {
+            reporter = std::make_unique<ProgressReporter>(options.progress_ms,
+                    [this]() { report_progress(); });
+        }
+
+        num_restored_passes = persistent() ? load_bank() : 0;
+        if (num_restored_passes > 0 && seen_bytes()[sol_result / 8] & (1 << (sol_result % 8))) {
+            sol_index = find_term_with_result(sol_result);
+            next_pass = schedule.size();
+        }
+    }
+
+    // Stop synthesis in the pass of the given height, because stop_requested
+    // returned true.
+    void stop(int32_t height) {
+        BudgetLimit limit = exceeded_limit.load(std::memory_order_relaxed);
+        if (limit == BudgetLimit::None) {
+            *options.log << "\tstopped" << std::endl;
+        } else {
+            budget = {limit, height, num_terms};
+            *options.log << "\t";
+            budget.print(*options.log);
+            *options.log << std::endl;
+        }
+        next_pass = schedule.size();
+    }
+
+    void finish() {
+        finished = true;
+        reporter.reset();
+        *options.log << synth_ms << " ms, "
             << num_terms << " terms" << std::endl;
 
-        return sol_index == NOT_FOUND ? nullptr : reconstruct(sol_index);
+        if (options.numa_report) {
+            numa_report_placement(*options.log, "bank", term_results,
+                    num_terms * sizeof(Result), {});
+            if (seen_bytes() != nullptr) {
+                numa_report_placement(*options.log, "seen", seen_bytes(),
+                        CEIL_DIV(max_distinct_terms, 8), thread_nodes());
+            }
+        }
+
+        solution_expr = sol_index == NOT_FOUND ? nullptr : reconstruct(sol_index);
+    }
+
+    // Do up to max_tiles tiles of the pass in progress, starting it if
+    // needed. Returns true once the pass is over: it was completed, found a
+    // solution, or was stopped.
+    bool step_pass(int64_t &max_tiles) {
+        auto [height, type] = schedule[next_pass];
+        if (next_tile == 0) {
+            *options.log << "height " << height << ", " << pass_type_name(type)
+                << " pass" << std::endl;
+            pass_ns = 0;
+            pass_prev_num_terms = num_terms;
+            counter_slots.reset();
+            if (perf != nullptr) {
+                perf->reset();
+            }
+            if (tiles_done != nullptr) {
+                *tiles_done = 0;
+            }
+            progress_num_tiles.store(0, std::memory_order_relaxed);
+            pass_begin = std::chrono::steady_clock::now();
+            begin_pass(type, height);
+        }
+
+        tiles_begin = next_tile;
+        tiles_end = next_tile + std::min(max_tiles, INT64_MAX - next_tile);
+        pass_tiles = 0;
+        Timer pass_timer;
+        uint64_t trace_begin = tracer != nullptr ? tracer->now() : 0;
+        if (perf != nullptr) {
+            perf->enable();
+        }
+        set_pass_running(true);
+        sol_index = run_pass(type, height);
+        set_pass_running(false);
+        if (perf != nullptr) {
+            perf->disable();
+        }
+        pass_ns += pass_timer.ns();
+        if (tracer != nullptr) {
+            tracer->record(pass_type_name(type), "height", height, trace_begin);
+        }
+
+        // Every call costs at least one tile, so that passes without tiles
+        // still count against the budget.
+        int64_t done_end = std::min(tiles_end, pass_tiles);
+        max_tiles -= std::max(done_end - tiles_begin, (int64_t) 1);
+        next_tile = tiles_end;
+        if (sol_index == NOT_FOUND && !stop_requested() && done_end < pass_tiles) {
+            return false;
+        }
+
+        // Passes charge every new term the widest operands, so the memory
+        // actually allocated is checked once the pass is recorded.
+        record_pass(type, height);
+        if (options.max_memory_bytes > 0 && estimated_bytes(num_terms) > options.max_memory_bytes) {
+            exceed(BudgetLimit::Memory);
+        }
+        *options.log << "\t" << pass_ns / 1000000 << " ms, "
+            << (num_terms - pass_prev_num_terms) << " new term(s), "
+            << num_terms << " total term(s)"
+            << std::endl;
+        if (perf != nullptr) {
+            *options.log << "\t";
+            perf->read().print(*options.log);
+        }
+        PassStats stats = {(int32_t) spec.num_examples, height, pass_type_name(type), pass_ns,
+            num_terms - pass_prev_num_terms, num_terms, counter_slots.total()};
+        if (!options.stats_path.empty()) {
+            write_pass_stats(options.stats_path, stats);
+        }
+        if (options.on_pass) {
+            options.on_pass(stats);
+        }
+        next_pass++;
+        next_tile = 0;
+        return true;
+    }
+
+public:
+    // Do a bounded amount of synthesis, and return true once it is done,
+    // after which solution() is the result. Synthesis is suspended between
+    // calls, so a host can interleave other work, or other synthesizers.
+    //
+    // A call does at most max_tiles tiles, where each tile is a fixed amount
+    // of work of a binary pass (see tile_range), and every other pass counts
+    // as one tile. The passes are run in order of increasing height, and the
+    // bank is checkpointed after every pass without a solution, as if
+    // synthesis ran without stopping.
+    bool step(int64_t max_tiles) {
+        Timer step_timer;
+        if (!started) {
+            start();
+        }
+
+        while (!finished) {
+            if (next_pass == schedule.size()) {
+                synth_ms += step_timer.ms();
+                finish();
+                return true;
+            }
+
+            if (next_pass < num_restored_passes) {
+                assert(pass_types[next_pass] == schedule[next_pass].second
+                        && pass_heights[next_pass] == schedule[next_pass].first);
+                *options.log << "height " << schedule[next_pass].first << ", "
+                    << pass_type_name(schedule[next_pass].second)
+                    << " pass restored" << std::endl;
+                next_pass++;
+                continue;
+            }
+
+            if (max_tiles <= 0) {
+                break;
+            }
+            if (next_tile == 0 && stop_requested()) {
+                stop(schedule[next_pass].first);
+                continue;
+            }
+            if (!step_pass(max_tiles)) {
+                continue;
+            }
+
+            // A pass that stopped early must not be checkpointed.
+            if (sol_index != NOT_FOUND) {
+                next_pass = schedule.size();
+            } else if (stop_requested()) {
+                stop(schedule[next_pass - 1].first);
+            } else if (persistent() && pass_ends.back() > pass_starts.back()) {
+                // Passes that add no terms are saved with the next one.
+                Timer checkpoint_timer;
+                save_bank();
+                *options.log << "\tcheckpoint: "
+                    << checkpoint_timer.ms() << " ms" << std::endl;
+            }
+        }
+
+        synth_ms += step_timer.ms();
+        return finished;
+    }
+
+    // The Expr satisfying spec, or nullptr if it cannot be found. Only valid
+    // once step has returned true.
+    const Expr* solution() const {
+        return solution_expr;
+    }
+
+    // Which budget stopped synthesis, if any. Only valid once step has
+    // returned true.
+    const BudgetStatus& budget_status() const {
+        return budget;
+    }
+
+    // The number of terms in the bank.
+    int64_t bank_size() const {
+        return num_terms;
+    }
+
+    // Return an Expr satisfying spec, or nullptr if it cannot be found.
+    const Expr* synthesize() {
+        while (!step(INT64_MAX)) {}
+        return solution();
+    }
+};
+
+// Runs Impl<Result> with the narrowest result type that fits the examples of
+// the spec. Most CEGIS iterations have few examples, and the passes over a
+// bank of uint16_t results need a fraction of the bandwidth. Specs with at
+// most 8 examples don't need a bank at all, and use ClosureSynthesizer.
+template <template <typename> class Impl>
+class WidthDispatch {
+private:
+    Spec spec;
+
+    const Options options;
+
+    // The synthesizer in progress (see step), if any. It is freed once it is
+    // done, along with its bank.
+    std::unique_ptr<Impl<uint16_t>> narrow;
+    std::unique_ptr<Impl<uint32_t>> wide;
+
+    bool finished;
+    const Expr* solution_expr;
+    BudgetStatus budget;
+    int64_t bank_terms;
+
+    template <typename Synth>
+    bool step(std::unique_ptr<Synth> &synthesizer, int64_t max_tiles) {
+        if (synthesizer == nullptr) {
+            synthesizer = std::make_unique<Synth>(spec, options);
+        }
+        if (synthesizer->step(max_tiles)) {
+            finished = true;
+            solution_expr = synthesizer->solution();
+            budget = synthesizer->budget_status();
+            bank_terms = synthesizer->bank_size();
+            synthesizer.reset();
+        }
+        return finished;
+    }
+
+public:
+    WidthDispatch(Spec spec, const Options &options = Options()) :
+        spec(spec), options(options), finished(false), solution_expr(nullptr), bank_terms(0) {}
+
+    // Do at most max_tiles tiles of synthesis, and return true once it is
+    // done (see AbstractSynthesizer::step). ClosureSynthesizer has no tiles,
+    // and finishes in the first call.
+    bool step(int64_t max_tiles) {
+        if (finished) {
+            return true;
+        }
+        if (spec.num_examples <= CLOSURE_MAX_EXAMPLES) {
+            finished = true;
+            solution_expr = ClosureSynthesizer(spec, *options.log).synthesize();
+            return true;
+        }
+        if (spec.num_examples <= 16) {
+            return step(narrow, max_tiles);
+        }
+        return step(wide, max_tiles);
+    }
+
+    // The Expr satisfying spec, or nullptr if it cannot be found. Only valid
+    // once step has returned true.
+    const Expr* solution() const {
+        return solution_expr;
+    }
+
+    // Which budget stopped synthesis, if any. ClosureSynthesizer is quick
+    // enough that it isn't budgeted.
+    const BudgetStatus& budget_status() const {
+        return budget;
+    }
+
+    // The number of terms in the bank once synthesis is done, or 0 for
+    // ClosureSynthesizer, which has no bank.
+    int64_t bank_size() const {
+        return bank_terms;
+    }
+
+    // Return an Expr satisfying spec, or nullptr if it cannot be found.
+    const Expr* synthesize() {
+        while (!step(INT64_MAX)) {}
+        return solution();
     }
 };
 
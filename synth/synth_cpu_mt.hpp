@@ -1,68 +1,375 @@
 // Multi-threaded CPU-based synthesizer.
+//
+// Binary passes can also be split across several processes (see
+// for_each_tile), with --shards=N. The bank and seen are then allocated in
+// memory that is shared with the processes forked for each pass, or in files
+// if the bank is spilled.
 
 #ifndef SYNTH_CPU_MT_H
 #define SYNTH_CPU_MT_H
 
+#include <algorithm>
+#include <cerrno>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <omp.h>
+#include <stdexcept>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "bitset.hpp"
 #include "expr.hpp"
 #include "spec.hpp"
+#include "stats.hpp"
 #include "synth.hpp"
+#include "util.hpp"
 
 // Set experimentally.
 #define TILE_SIZE 64
 
 #define UNARY_TILE_SIZE 4096
 
-class Synthesizer : public AbstractSynthesizer {
+// Number of rows of tiles to read ahead in binary passes, if the bank is
+// spilled.
+#define READAHEAD_TILES 1024
+
+template <typename Result>
+class TypedSynthesizer : public AbstractSynthesizer<Result> {
 private:
+    typedef AbstractSynthesizer<Result> Base;
+    using Base::NOT_FOUND;
+    using Base::spec;
+    using Base::result_mask;
+    using Base::sol_result;
+    using Base::num_terms;
+    using Base::term_results;
+    using Base::terms_with_height_start;
+    using Base::terms_with_height_end;
+    using Base::find_term_with_result;
+    using Base::find_check_pair;
+    using Base::store_operands;
+    using Base::tracer;
+
     // The i'th bit is on iff the bank contains a term whose bitvector
     // of evaluation results is equal to i.
     ThreadSafeBitset seen;
 
 public:
-    Synthesizer(Spec spec) : AbstractSynthesizer(spec),
-            seen(ThreadSafeBitset(max_distinct_terms)) {}
+    TypedSynthesizer(Spec spec, const Options &options = Options()) :
+            Base(spec, options, std::max(omp_get_max_threads(), options.shards)),
+            seen(ThreadSafeBitset(this->max_distinct_terms, options.shards > 1)),
+            shards(options.shards),
+            shard(0),
+            shard_state(nullptr),
+            terms_counter(&num_terms) {
+        if (shards > 1) {
+            shard_state = (ShardState*) alloc_shared(sizeof(ShardState));
+        }
+
+        if (options.affinity != Affinity::None && numa_claim_pinning()) {
+            pinned_nodes.resize(omp_get_max_threads(), -1);
+            saved_affinities.resize(omp_get_max_threads());
+            #pragma omp parallel
+            {
+                int32_t thread = omp_get_thread_num();
+                if (thread < (int32_t) pinned_nodes.size()) {
+                    saved_affinities[thread] = ThreadAffinity::current();
+                    pinned_nodes[thread] = numa_pin_thread(thread, options.affinity);
+                }
+            }
+
+            // Terms are written by the thread that produced them, so with
+            // pinned threads, each page of the bank can be local to the
+            // thread that fills it, if it isn't placed before then. Shared
+            // and spilled banks keep their pages.
+            if (shards <= 1 && options.spill_dir.empty()) {
+                numa_first_touch(term_results, this->max_distinct_terms * sizeof(Result));
+            }
+        }
+
+        // seen is probed at random by every thread, so no placement is local
+        // to all of them, but interleaving spreads the load over every node.
+        if (options.interleave_seen) {
+            numa_interleave(seen.data(), CEIL_DIV(this->max_distinct_terms, 8));
+        }
+    }
+
+    ~TypedSynthesizer() {
+        // Every bit in seen is the result of a term in the bank.
+        seen.clear(term_results, num_terms);
+        if (shard_state != nullptr) {
+            dealloc(shard_state, sizeof(ShardState));
+        }
+
+        // The threads belong to the caller's OpenMP team, which outlives the
+        // synthesizer, so they are given back their previous CPUs.
+        if (!saved_affinities.empty()) {
+            #pragma omp parallel
+            {
+                int32_t thread = omp_get_thread_num();
+                if (thread < (int32_t) saved_affinities.size()) {
+                    saved_affinities[thread].restore();
+                }
+            }
+            numa_release_pinning();
+        }
+    }
 
 private:
+    // State that the shards of a binary pass update together. Shards are
+    // separate processes, which don't see a cancel in the parent or a budget
+    // exceeded in another shard, so the first shard to stop sets stop, and
+    // the BudgetLimit it exceeded, if any.
+    struct ShardState {
+        int64_t num_terms;
+        int64_t solution;
+        int32_t stop;
+        int32_t exceeded_limit;
+    };
+
+    int32_t shards;
+
+    // The shard that this process runs while the shards of a pass are
+    // running, and 0 otherwise.
+    int32_t shard;
+
+    // In memory shared with the shards, or nullptr if there is one shard.
+    ShardState* shard_state;
+
+    // Where alloc_terms counts terms: num_terms, or shard_state->num_terms
+    // while the shards of a pass are running.
+    int64_t* terms_counter;
+
+    // The node of each OpenMP thread, and its affinity before it was pinned,
+    // if they are pinned.
+    std::vector<int32_t> pinned_nodes;
+    std::vector<ThreadAffinity> saved_affinities;
+
+    uint8_t* seen_bytes() {
+        return seen.data();
+    }
+
+    std::vector<int32_t> thread_nodes() {
+        return pinned_nodes;
+    }
+
+    // The binary passes sweep the rows of tiles roughly in order, so each
+    // lower term is read once, and read ahead (see READAHEAD_TILES).
+    Access lower_terms_access() {
+        return Access::Sequential;
+    }
+
+    std::vector<pid_t> worker_threads() {
+        std::vector<pid_t> threads(omp_get_max_threads(), 0);
+        #pragma omp parallel
+        {
+            int32_t thread = omp_get_thread_num();
+            if (thread < (int32_t) threads.size()) {
+                threads[thread] = current_thread_id();
+            }
+        }
+        // The team may have fewer threads than the maximum.
+        threads.erase(std::remove(threads.begin(), threads.end(), 0), threads.end());
+        return threads;
+    }
+
+    int64_t current_num_terms() {
+        return __atomic_load_n(terms_counter, __ATOMIC_RELAXED);
+    }
+
+    // Whether synthesis should stop (see AbstractSynthesizer::stop_requested).
+    // While the shards of a pass are running, this also stops when another
+    // shard has, and tells the other shards when this one stops.
+    bool stop_requested() {
+        if (terms_counter == &num_terms) {
+            return Base::stop_requested();
+        }
+        if (__atomic_load_n(&shard_state->stop, __ATOMIC_RELAXED)) {
+            return true;
+        }
+        if (!Base::stop_requested()) {
+            return false;
+        }
+        int32_t none = (int32_t) BudgetLimit::None;
+        __atomic_compare_exchange_n(&shard_state->exceeded_limit, &none,
+                (int32_t) this->exceeded_budget(), false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        __atomic_store_n(&shard_state->stop, 1, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    // The counters of the calling thread (see stats.hpp). Shards run on one
+    // thread each, so each of them has its own slot as well.
+    PassCounters& counters() {
+        return this->counter_slots[shard + omp_get_thread_num()];
+    }
+
     // Allocate the specified number of contiguous indices in the bank for new
     // terms, and return the first index in that contiguous region.
     int64_t alloc_terms(int64_t count) {
+        STATS(counters().alloc_calls++);
         // Increment the number of terms atomically (for thread safety), and
         // return the previous value, which is also the first free index.
-        return __atomic_fetch_add(&num_terms, count, __ATOMIC_SEQ_CST);
+        return __atomic_fetch_add(terms_counter, count, __ATOMIC_SEQ_CST);
+    }
+
+    // Call tile(b, solution) for every b in [0, count) within the range of
+    // tiles that the pass should do (see tile_range), and return the index of
+    // a solution, or NOT_FOUND. tile skips its work if solution isn't
+    // NOT_FOUND, and sets it when it adds a solution to the bank.
+    //
+    // With one shard, the tiles are run by the OpenMP team. Otherwise, the
+    // range is split into one contiguous range per shard, and a process is
+    // forked for each range but the first, which this process runs. The bank,
+    // its operands, and seen are shared, as are the number of terms and the
+    // solution, so a solution found by any shard stops the others, and so
+    // does a cancel or an exceeded budget (see stop_requested). Waiting for
+    // every shard to exit is the barrier at the end of the pass. Each shard
+    // runs on one thread, since OpenMP can't be used after a fork, and isn't
+    // pinned, since it would inherit the CPU of the thread that forked it.
+    // Forking is only safe while no other thread is running, so shards
+    // aren't supported when several jobs run in one process.
+    template <typename Tile>
+    int64_t for_each_tile(int64_t count, Tile tile) {
+        int64_t begin, end;
+        this->tile_range(count, begin, end);
+        // Each tile is an event in the trace, if there is one, and counts
+        // toward the progress of the pass.
+        auto traced_tile = [&](int64_t b, int64_t &solution) {
+            if (tracer == nullptr) {
+                tile(b, solution);
+            } else {
+                uint64_t trace_begin = tracer->now();
+                tile(b, solution);
+                tracer->record("tile", "b", b, trace_begin);
+            }
+            this->count_tile();
+        };
+
+        if (shards <= 1) {
+            int64_t solution = NOT_FOUND;
+            #pragma omp parallel
+            {
+                uint64_t trace_begin = tracer != nullptr ? tracer->now() : 0;
+                #pragma omp for nowait
+                for (int64_t b = begin; b < end; b++) {
+                    traced_tile(b, solution);
+                }
+                // The time after this, until the end of the pass, is spent
+                // waiting for the other threads.
+                if (tracer != nullptr) {
+                    tracer->record("work", "thread", omp_get_thread_num(), trace_begin);
+                }
+            }
+            return solution;
+        }
+
+        shard_state->num_terms = num_terms;
+        shard_state->solution = NOT_FOUND;
+        shard_state->stop = 0;
+        shard_state->exceeded_limit = (int32_t) BudgetLimit::None;
+        terms_counter = &shard_state->num_terms;
+
+        auto run_shard = [&](int32_t index) {
+            shard = index;
+            for (int64_t b = begin + (end - begin) * index / shards;
+                    b < begin + (end - begin) * (index + 1) / shards; b++) {
+                traced_tile(b, shard_state->solution);
+            }
+        };
+
+        // Failures are thrown once every shard that started has exited, since
+        // the shards write to the bank.
+        std::vector<pid_t> children;
+        std::string error;
+        std::fflush(nullptr);
+        for (int32_t i = 1; i < shards; i++) {
+            pid_t pid = fork();
+            if (pid == -1) {
+                error = std::string("fork: ") + std::strerror(errno);
+                __atomic_store_n(&shard_state->stop, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            if (pid == 0) {
+                // Nothing may unwind past this in the child.
+                try {
+                    if (!saved_affinities.empty()) {
+                        saved_affinities[0].restore();
+                    }
+                    run_shard(i);
+                } catch (...) {
+                    _exit(1);
+                }
+                _exit(0);
+            }
+            children.push_back(pid);
+        }
+        if (error.empty()) {
+            try {
+                run_shard(0);
+            } catch (const std::exception &e) {
+                error = e.what();
+                __atomic_store_n(&shard_state->stop, 1, __ATOMIC_RELAXED);
+            }
+        }
+
+        // A cancel only reaches this process, so it is still checked for
+        // while the other shards finish.
+        for (pid_t pid : children) {
+            int status;
+            pid_t waited;
+            while ((waited = waitpid(pid, &status, WNOHANG)) == 0) {
+                stop_requested();
+                usleep(100);
+            }
+            if ((waited == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                    && error.empty()) {
+                error = "shard process " + std::to_string(pid) + " failed";
+            }
+        }
+
+        if (!error.empty()) {
+            terms_counter = &num_terms;
+            throw std::runtime_error(error);
+        }
+        terms_counter = &num_terms;
+        num_terms = shard_state->num_terms;
+        BudgetLimit limit = (BudgetLimit) shard_state->exceeded_limit;
+        if (limit != BudgetLimit::None) {
+            this->exceed(limit);
+        }
+        return shard_state->solution;
     }
 
     // Add the specified number of NOT terms or variable terms to the bank.
-    int64_t add_unary_terms(int64_t count, uint32_t *results, uint32_t *lefts) {
+    int64_t add_unary_terms(int64_t count, Result *results, Result *lefts) {
         int64_t start = alloc_terms(count);
-        memcpy(&term_results[start], results, count * sizeof(uint32_t));
-        memcpy(&term_lefts[start], lefts, count * sizeof(uint32_t));
+        memcpy(&term_results[start], results, count * sizeof(Result));
+        store_operands(start, count, lefts, (Result*) nullptr);
         return start;
     }
 
     // Add the specified number of binary operator terms to the bank.
-    int64_t add_binary_terms(int64_t count, uint32_t *results, uint32_t *lefts,
-            uint32_t *rights) {
+    int64_t add_binary_terms(int64_t count, Result *results, Result *lefts,
+            Result *rights) {
         int64_t start = alloc_terms(count);
-        memcpy(&term_results[start], results, count * sizeof(uint32_t));
-        memcpy(&term_lefts[start], lefts, count * sizeof(uint32_t));
-        memcpy(&term_rights[start], rights, count * sizeof(uint32_t));
+        memcpy(&term_results[start], results, count * sizeof(Result));
+        store_operands(start, count, lefts, rights);
         return start;
     }
 
-    int64_t add_binary_term(uint32_t result, uint32_t left, uint32_t right) {
-        return add_binary_terms(1, &result, &left, &right);
+    // Add a single term to the bank. Operands are taken as uint32_t, since
+    // variable numbers needn't fit in Result.
+    int64_t add_binary_term(Result result, uint32_t left, uint32_t right) {
+        int64_t index = alloc_terms(1);
+        term_results[index] = result;
+        store_operands(index, left, right);
+        return index;
     }
 
-    int64_t add_unary_term(uint32_t result, uint32_t left) {
-        // The right index of a unary term is unused, so we can use whatever
-        // value we want.
-        uint32_t right = 0;
-        return add_binary_term(result, left, right);
+    int64_t add_unary_term(Result result, uint32_t left) {
+        return add_binary_term(result, left, 0);
     }
 
     // Add variables of the specified height to the bank.
@@ -72,14 +379,16 @@ private:
                 continue;
             }
 
-            uint32_t result = spec.var_values[i];
+            Result result = spec.var_values[i];
+            STATS(counters().probes++);
             if (seen.test_and_set(result)) {
+                STATS(counters().hits++);
                 continue;
             }
 
             add_unary_term(result, i);
 
-            if (result == spec.sol_result) {
+            if (result == sol_result) {
                 return num_terms - 1;
             }
         }
@@ -120,20 +429,21 @@ private:
             // The cancel construct (#pragma omp cancel) needs an extra
             // environment variable to work properly, so this is less effort. I
             // haven't tested whether cancelling has better performance though.
-            if (solution != NOT_FOUND) {
+            if (solution != NOT_FOUND || stop_requested()) {
+                STATS(counters().skipped_tiles++);
                 continue;
             }
 
             int32_t batch_size = 0;
-            uint32_t batch_results[UNARY_TILE_SIZE];
-            uint32_t batch_lefts[UNARY_TILE_SIZE];
+            Result batch_results[UNARY_TILE_SIZE];
+            Result batch_lefts[UNARY_TILE_SIZE];
 
             // Loop over the operands in the tile.
-            for (int64_t left = std::max(lefts_tile * UNARY_TILE_SIZE, all_lefts_start);
-                    left < std::min((lefts_tile + 1) * UNARY_TILE_SIZE, all_lefts_end);
-                    left++) {
-                uint32_t left_result = term_results[left];
-                uint32_t result = result_mask & ~left_result;
+            int64_t lefts_start = std::max(lefts_tile * UNARY_TILE_SIZE, all_lefts_start);
+            int64_t lefts_end = std::min((lefts_tile + 1) * UNARY_TILE_SIZE, all_lefts_end);
+            for (int64_t left = lefts_start; left < lefts_end; left++) {
+                Result left_result = term_results[left];
+                Result result = result_mask & ~left_result;
                 if (seen.test_and_set(result)) {
                     continue;
                 }
@@ -144,6 +454,11 @@ private:
                 batch_size++;
             }
 
+            // Every operand that didn't add a term hit seen.
+            STATS(counters().tiles++);
+            STATS(counters().probes += lefts_end - lefts_start);
+            STATS(counters().hits += lefts_end - lefts_start - batch_size);
+
             if (batch_size == 0) {
                 continue;
             }
@@ -151,7 +466,7 @@ private:
             // Check if any of the new terms in the batch are valid solutions.
             int64_t bank_index = add_unary_terms(batch_size, batch_results, batch_lefts);
             for (int32_t i = 0; i < batch_size; i++) {
-                if (batch_results[i] == spec.sol_result) {
+                if (batch_results[i] == sol_result) {
                     // No synchronization needed, because if two threads find a
                     // solution simultaneously, it doesn't matter which we use.
                     solution = bank_index + i;
@@ -177,20 +492,24 @@ private:
                 lefts_tile < CEIL_DIV(all_lefts_end, UNARY_TILE_SIZE);
                 lefts_tile++) {
             if (solution != NOT_FOUND) {
+                STATS(counters().skipped_tiles++);
                 continue;
             }
 
+            STATS(counters().tiles++);
             for (int64_t left = std::max(lefts_tile * UNARY_TILE_SIZE, all_lefts_start);
                     left < std::min((lefts_tile + 1) * UNARY_TILE_SIZE, all_lefts_end);
                     left++) {
-                uint32_t left_result = term_results[left];
-                uint32_t right_result = left_result ^ spec.sol_result;
+                Result left_result = term_results[left];
+                Result right_result = left_result ^ sol_result;
+                STATS(counters().probes++);
 
                 if (seen.test(right_result)
                         // Guarantee that only one thread will execute the following code.
                         && __atomic_exchange_n(&found_solution, true, __ATOMIC_SEQ_CST) == false) {
+                    STATS(counters().hits++);
                     uint32_t right = find_term_with_result(right_result);
-                    solution = add_binary_term(spec.sol_result, left, right);
+                    solution = add_binary_term(sol_result, left, right);
                     break;
                 }
             }
@@ -198,9 +517,27 @@ private:
         return solution;
     }
 
+    int64_t pass_AndCheck(int32_t height) {
+        uint32_t left = 0, right = 0;
+        if (!find_check_pair(height, 0, left, right)) {
+            return NOT_FOUND;
+        }
+
+        return add_binary_term(sol_result, left, right);
+    }
+
+    int64_t pass_OrCheck(int32_t height) {
+        uint32_t left = 0, right = 0;
+        if (!find_check_pair(height, result_mask, left, right)) {
+            return NOT_FOUND;
+        }
+
+        return add_binary_term(sol_result, left, right);
+    }
+
     // Add binary operator terms (AND, OR, XOR) to the bank.
     template <typename Op>
-    friend int64_t pass_binary(Synthesizer &self, int32_t height, Op op) {
+    friend int64_t pass_binary(TypedSynthesizer &self, int32_t height, Op op) {
         // The left operand can be any term whose height is less than the
         // current height.
         int64_t all_lefts_end = self.terms_with_height_end(height - 1);
@@ -210,8 +547,6 @@ private:
         int64_t all_rights_start = self.terms_with_height_start(height - 1);
         int64_t all_rights_end = all_lefts_end;
 
-        int64_t solution = Synthesizer::NOT_FOUND;
-
         // We need to iterate over the trapezoidal region of (left, right) pairs
         // such that:
         //
@@ -285,45 +620,52 @@ private:
         int64_t k = all_rights_start / TILE_SIZE;
         int64_t n = CEIL_DIV(all_rights_end, TILE_SIZE);
 
-        #pragma omp parallel for
         // b is a 1D index as described above, and it uniquely identifies one of
         // the tiles covering the trapezoidal region.
-        for (int64_t b = 0; b < k * (n - k) + (n - k) * (n - k + 1) / 2; b++) {
-            if (solution != Synthesizer::NOT_FOUND) {
-                continue;
+        int64_t num_tiles = trapezoid_num_tiles(k, n);
+        return self.for_each_tile(num_tiles, [&](int64_t b, int64_t &solution) {
+            if (solution != TypedSynthesizer::NOT_FOUND || self.stop_requested()) {
+                STATS(self.counters().skipped_tiles++);
+                return;
             }
 
-            int64_t lefts_tile = b / (n - k);
-            int64_t rights_tile = n - 1 - b % (n - k);
-            if (lefts_tile > rights_tile) {
-                // As described above, this tile is inside the rectangle but
-                // outside the trapezoid, so we need to transform its
-                // coordinates.
-                lefts_tile = n - (lefts_tile - (k + 1)) - 1;
-                rights_tile = n - (rights_tile - k) - 1;
+            int64_t row = b / (n - k);
+            if (b % (n - k) == 0 && row % READAHEAD_TILES == 0) {
+                // Rows are visited roughly in order, so if the bank is
+                // spilled, start reading the left operands of the next window
+                // of rows. The right operands are read by every row, so they
+                // stay in memory.
+                self.prefetch_terms((row + READAHEAD_TILES) * TILE_SIZE,
+                        READAHEAD_TILES * TILE_SIZE);
             }
 
+            // Tiles inside the rectangle but outside the trapezoid are moved
+            // inside it, as described above.
+            int64_t lefts_tile, rights_tile;
+            trapezoid_tile(b, k, n, lefts_tile, rights_tile);
+
             int32_t batch_size = 0;
-            uint32_t batch_results[TILE_SIZE * TILE_SIZE];
-            uint32_t batch_lefts[TILE_SIZE * TILE_SIZE];
-            uint32_t batch_rights[TILE_SIZE * TILE_SIZE];
+            Result batch_results[TILE_SIZE * TILE_SIZE];
+            Result batch_lefts[TILE_SIZE * TILE_SIZE];
+            Result batch_rights[TILE_SIZE * TILE_SIZE];
 
             // Use min to ensure that we don't read terms that are out of bounds
-            // on the right side. However, it's okay if we're out of bounds on
-            // the left side or on the wrong side of the diagonal: the terms we
-            // synthesize from those pairings are still valid, they're just
-            // equivalent to other terms that are in bounds. This happens rarely
-            // enough (only on tiles on the perimeter) that it's not worth
-            // checking for.
-            for (int64_t left = lefts_tile * TILE_SIZE;
-                    left < std::min((lefts_tile + 1) * TILE_SIZE, all_lefts_end);
-                    left++) {
-                uint32_t left_result = self.term_results[left];
-                for (int64_t right = rights_tile * TILE_SIZE;
-                        right < std::min((rights_tile + 1) * TILE_SIZE, all_rights_end);
-                        right++) {
-                    uint32_t right_result = self.term_results[right];
-                    uint32_t result = op(left_result, right_result, self.result_mask);
+            // on the right side. However, it's okay to be on the wrong side of
+            // the diagonal: the terms we synthesize from those pairings are
+            // still valid, they're just equivalent to other terms that are in
+            // bounds. This happens rarely enough (only on tiles on the
+            // diagonal) that it's not worth checking for. Right operands must
+            // have height `height - 1`, since that's what the operand encoding
+            // expects (see TermOperands).
+            int64_t lefts_start = lefts_tile * TILE_SIZE;
+            int64_t lefts_end = std::min((lefts_tile + 1) * TILE_SIZE, all_lefts_end);
+            int64_t rights_start = std::max(rights_tile * TILE_SIZE, all_rights_start);
+            int64_t rights_end = std::min((rights_tile + 1) * TILE_SIZE, all_rights_end);
+            for (int64_t left = lefts_start; left < lefts_end; left++) {
+                Result left_result = self.term_results[left];
+                for (int64_t right = rights_start; right < rights_end; right++) {
+                    Result right_result = self.term_results[right];
+                    Result result = op(left_result, right_result, self.result_mask);
                     if (self.seen.test_and_set(result)) {
                         continue;
                     }
@@ -335,38 +677,45 @@ private:
                 }
             }
 
+            // Every pair that didn't add a term hit seen.
+            STATS(int64_t num_pairs = std::max(lefts_end - lefts_start, (int64_t) 0)
+                    * std::max(rights_end - rights_start, (int64_t) 0));
+            STATS(self.counters().tiles++);
+            STATS(self.counters().probes += num_pairs);
+            STATS(self.counters().hits += num_pairs - batch_size);
+
             if (batch_size == 0) {
-                continue;
+                return;
             }
 
             int64_t bank_index = self.add_binary_terms(
                     batch_size, batch_results, batch_lefts, batch_rights);
             for (int32_t i = 0; i < batch_size; i++) {
-                if (batch_results[i] == self.spec.sol_result) {
+                if (batch_results[i] == self.sol_result) {
                     // No synchronization needed, because if two threads find a
                     // solution simultaneously, it doesn't matter which we use.
                     solution = bank_index + i;
                 }
             }
-        }
-
-        return solution;
+        });
     }
 
     int64_t pass_And(int32_t height) {
-        auto op = [](uint32_t a, uint32_t b, uint32_t result_mask __attribute__((unused))) { return a & b; };
+        auto op = [](Result a, Result b, Result result_mask __attribute__((unused))) { return a & b; };
         return pass_binary(*this, height, op);
     }
 
     int64_t pass_Or(int32_t height) {
-        auto op = [](uint32_t a, uint32_t b, uint32_t result_mask __attribute__((unused))) { return a | b; };
+        auto op = [](Result a, Result b, Result result_mask __attribute__((unused))) { return a | b; };
         return pass_binary(*this, height, op);
     }
 
     int64_t pass_XorSynth(int32_t height) {
-        auto op = [](uint32_t a, uint32_t b, uint32_t result_mask __attribute__((unused))) { return a ^ b; };
+        auto op = [](Result a, Result b, Result result_mask __attribute__((unused))) { return a ^ b; };
         return pass_binary(*this, height, op);
     }
 };
 
+typedef WidthDispatch<TypedSynthesizer> Synthesizer;
+
 #endif
@@ -8,11 +8,26 @@
 #include "bitset.hpp"
 #include "expr.hpp"
 #include "spec.hpp"
+#include "stats.hpp"
 #include "synth.hpp"
 #include "timer.hpp"
 
-class Synthesizer : public AbstractSynthesizer {
+template <typename Result>
+class TypedSynthesizer : public AbstractSynthesizer<Result> {
 private:
+    typedef AbstractSynthesizer<Result> Base;
+    using Base::NOT_FOUND;
+    using Base::spec;
+    using Base::result_mask;
+    using Base::sol_result;
+    using Base::num_terms;
+    using Base::term_results;
+    using Base::terms_with_height_start;
+    using Base::terms_with_height_end;
+    using Base::find_term_with_result;
+    using Base::find_check_pair;
+    using Base::store_operands;
+
     // The i'th bit is on iff the bank contains a term whose bitvector
     // of evaluation results is equal to i.
     // This is used to avoid inserting new terms that are observationally
@@ -20,28 +35,43 @@ private:
     SingleThreadedBitset seen;
 
 public:
-    Synthesizer(Spec spec) : AbstractSynthesizer(spec),
-        seen(SingleThreadedBitset(max_distinct_terms)) {}
+    TypedSynthesizer(Spec spec, const Options &options = Options()) :
+        Base(spec, options),
+        seen(SingleThreadedBitset(this->max_distinct_terms)) {}
+
+    ~TypedSynthesizer() {
+        // Every bit in seen is the result of a term in the bank.
+        seen.clear(term_results, num_terms);
+    }
 
 private:
+    uint8_t* seen_bytes() {
+        return seen.data();
+    }
+
+    // The counters of the pass in progress (see stats.hpp).
+    PassCounters& counters() {
+        return this->counter_slots[0];
+    }
+
     // Return the next free index to be used for a new term.
     int64_t alloc_term() {
+        STATS(counters().alloc_calls++);
         return num_terms++;
     }
 
     // Add a NOT term or variable term to the bank.
-    void add_unary_term(uint32_t result, uint32_t left) {
+    void add_unary_term(Result result, uint32_t left) {
         int64_t index = alloc_term();
         term_results[index] = result;
-        term_lefts[index] = left;
+        store_operands(index, left, 0);
     }
 
     // Add a binary operator term to the bank.
-    void add_binary_term(uint32_t result, uint32_t left, uint32_t right) {
+    void add_binary_term(Result result, uint32_t left, uint32_t right) {
         int64_t index = alloc_term();
         term_results[index] = result;
-        term_lefts[index] = left;
-        term_rights[index] = right;
+        store_operands(index, left, right);
     }
 
     // Add variables of the specified height to the bank.
@@ -51,14 +81,16 @@ private:
                 continue;
             }
 
-            uint32_t result = spec.var_values[i];
+            Result result = spec.var_values[i];
+            STATS(counters().probes++);
             if (seen.test_and_set(result)) {
+                STATS(counters().hits++);
                 continue;
             }
 
             add_unary_term(result, i);
 
-            if (result == spec.sol_result) {
+            if (result == sol_result) {
                 return num_terms - 1;
             }
         }
@@ -74,15 +106,17 @@ private:
         int64_t lefts_end = terms_with_height_end(height - 1);
 
         for (int64_t left = lefts_start; left < lefts_end; left++) {
-            uint32_t left_result = term_results[left];
-            uint32_t result = result_mask & ~left_result;
+            Result left_result = term_results[left];
+            Result result = result_mask & ~left_result;
+            STATS(counters().probes++);
             if (seen.test_and_set(result)) {
+                STATS(counters().hits++);
                 continue;
             }
 
             add_unary_term(result, left);
 
-            if (result == spec.sol_result) {
+            if (result == sol_result) {
                 return num_terms - 1;
             }
         }
@@ -98,20 +132,42 @@ private:
         int64_t lefts_end = terms_with_height_end(height - 1);
 
         for (int64_t left = lefts_start; left < lefts_end; left++) {
-            uint32_t left_result = term_results[left];
-            uint32_t right_result = left_result ^ spec.sol_result;
+            Result left_result = term_results[left];
+            Result right_result = left_result ^ sol_result;
+            STATS(counters().probes++);
             if (!seen.test(right_result)) {
                 continue;
             }
 
+            STATS(counters().hits++);
             int64_t right = find_term_with_result(right_result);
-            add_binary_term(spec.sol_result, left, right);
+            add_binary_term(sol_result, left, right);
             return num_terms - 1;
         }
 
         return NOT_FOUND;
     }
 
+    int64_t pass_AndCheck(int32_t height) {
+        uint32_t left = 0, right = 0;
+        if (!find_check_pair(height, 0, left, right)) {
+            return NOT_FOUND;
+        }
+
+        add_binary_term(sol_result, left, right);
+        return num_terms - 1;
+    }
+
+    int64_t pass_OrCheck(int32_t height) {
+        uint32_t left = 0, right = 0;
+        if (!find_check_pair(height, result_mask, left, right)) {
+            return NOT_FOUND;
+        }
+
+        add_binary_term(sol_result, left, right);
+        return num_terms - 1;
+    }
+
     // Synthesize binary operator terms (AND, OR, and XOR).
     //
     // We make this a template to avoid duplicating code between the three
@@ -122,51 +178,102 @@ private:
     // parameter. However, the compiler can't inline the lambda in that case,
     // which makes the code roughly twice as slow.
     template <typename Op>
-    friend int64_t pass_binary(Synthesizer &self, int32_t height, Op op) {
+    friend int64_t pass_binary(TypedSynthesizer &self, int32_t height, Op op) {
+        // Left operands are stored in the narrowest type that fits (see
+        // TermOperands), which is picked here once for the whole pass.
+        switch (self.pass_operands.back().layout().left_width) {
+            case 1:
+                return pass_binary_as<uint8_t>(self, height, op);
+            case 2:
+                return pass_binary_as<uint16_t>(self, height, op);
+            default:
+                return pass_binary_as<uint32_t>(self, height, op);
+        }
+    }
+
+    // pass_binary, storing left operands as Left.
+    template <typename Left, typename Op>
+    static int64_t pass_binary_as(TypedSynthesizer &self, int32_t height, Op op) {
         // The right operand must be a term whose height is one less than the
         // current height.
         int64_t rights_start = self.terms_with_height_start(height - 1);
         int64_t rights_end = self.terms_with_height_end(height - 1);
 
-        for (int64_t right = rights_start; right < rights_end; right++) {
-            uint32_t right_result = self.term_results[right];
+        // New terms are written straight to the pass's operand storage. The
+        // left operands range over [0, rights_end), so they need no offset,
+        // and the right operand is the same for a whole row, so it is filled
+        // in once the row is done.
+        TermOperands &operands = self.pass_operands.back();
+        Left* lefts = operands.lefts_as<Left>();
+        int64_t pass_start = self.current_pass_start();
+        assert(operands.layout().left_base == 0);
+
+        // Each right operand is a tile (see AbstractSynthesizer::step).
+        int64_t tiles_begin, tiles_end;
+        self.tile_range(rights_end - rights_start, tiles_begin, tiles_end);
+        for (int64_t right = rights_start + tiles_begin; right < rights_start + tiles_end; right++) {
+            if (self.stop_requested()) {
+                STATS(self.counters().skipped_tiles += rights_start + tiles_end - right);
+                break;
+            }
+            Result right_result = self.term_results[right];
+            STATS(self.counters().tiles++);
+            STATS(self.counters().probes += right + 1);
+
+            // Counted locally, since seen may alias the counters.
+            STATS(uint64_t row_hits = 0);
+            int64_t row_start = self.num_terms;
 
             // The left operand can be any term whose height is less than the
             // current height. Since each binary operator is commutative, we
             // only consider (left, right) pairs where left <= right, to avoid
             // constructing redundant terms.
             for (int64_t left = 0; left <= right; left++) {
-                uint32_t left_result = self.term_results[left];
-                uint32_t result = op(left_result, right_result, self.result_mask);
+                Result left_result = self.term_results[left];
+                Result result = op(left_result, right_result, self.result_mask);
                 if (self.seen.test_and_set(result)) {
+                    STATS(row_hits++);
                     continue;
                 }
 
-                self.add_binary_term(result, left, right);
-
-                if (result == self.spec.sol_result) {
+                int64_t index = self.alloc_term();
+                self.term_results[index] = result;
+                lefts[index - pass_start] = left;
+
+                if (result == self.sol_result) {
+                    operands.fill_rights(row_start - pass_start, self.num_terms - row_start, right);
+                    // The rest of the pairs of this row, and the rows after
+                    // it, weren't examined.
+                    STATS(self.counters().hits += row_hits);
+                    STATS(self.counters().probes -= right - left);
+                    STATS(self.counters().skipped_tiles += rights_start + tiles_end - right - 1);
                     return self.num_terms - 1;
                 }
             }
+            operands.fill_rights(row_start - pass_start, self.num_terms - row_start, right);
+            STATS(self.counters().hits += row_hits);
+            self.count_tile();
         }
 
-        return Synthesizer::NOT_FOUND;
+        return TypedSynthesizer::NOT_FOUND;
     }
 
     int64_t pass_And(int32_t height) {
-        auto op = [](uint32_t a, uint32_t b, uint32_t result_mask __attribute__((unused))) { return a & b; };
+        auto op = [](Result a, Result b, Result result_mask __attribute__((unused))) { return a & b; };
         return pass_binary(*this, height, op);
     }
 
     int64_t pass_Or(int32_t height) {
-        auto op = [](uint32_t a, uint32_t b, uint32_t result_mask __attribute__((unused))) { return a | b; };
+        auto op = [](Result a, Result b, Result result_mask __attribute__((unused))) { return a | b; };
         return pass_binary(*this, height, op);
     }
 
     int64_t pass_XorSynth(int32_t height) {
-        auto op = [](uint32_t a, uint32_t b, uint32_t result_mask __attribute__((unused))) { return a ^ b; };
+        auto op = [](Result a, Result b, Result result_mask __attribute__((unused))) { return a ^ b; };
         return pass_binary(*this, height, op);
     }
 };
 
+typedef WidthDispatch<TypedSynthesizer> Synthesizer;
+
 #endif
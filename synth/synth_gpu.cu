@@ -78,6 +78,7 @@ __device__ inline void add_unary_terms(
     uint32_t sol_result,
     uint32_t* __restrict__ term_results,
     uint32_t* __restrict__ term_lefts,
+    uint32_t pass_start,
     uint32_t is_new,
     uint32_t result,
     uint32_t left
@@ -115,7 +116,7 @@ __device__ inline void add_unary_terms(
         uint32_t bank_idx = bank_segment_start + threadIdx.x;
         uint32_t batch_result = batch_results[threadIdx.x];
         term_results[bank_idx] = batch_result;
-        term_lefts[bank_idx] = batch_lefts[threadIdx.x];
+        term_lefts[bank_idx - pass_start] = batch_lefts[threadIdx.x];
 
         if (batch_result == sol_result) {
             state->found_sol = true;
@@ -144,6 +145,7 @@ __global__ void pass_variable(
     uint32_t sol_result,
     uint32_t* __restrict__ term_results,
     uint32_t* __restrict__ term_lefts,
+    uint32_t pass_start,
     uint32_t num_vars,
     const uint32_t* __restrict__ var_values,
     const int32_t* __restrict__ var_heights
@@ -161,7 +163,7 @@ __global__ void pass_variable(
         }
     }
 
-    add_unary_terms(state, sol_result, term_results, term_lefts,
+    add_unary_terms(state, sol_result, term_results, term_lefts, pass_start,
             is_new, var_value, var_idx);
 }
 
@@ -172,6 +174,7 @@ __global__ void pass_not(
     uint32_t sol_result,
     uint32_t* __restrict__ term_results,
     uint32_t* __restrict__ term_lefts,
+    uint32_t pass_start,
     uint32_t all_lefts_start,
     uint32_t all_lefts_end
 ) {
@@ -188,7 +191,7 @@ __global__ void pass_not(
         }
     }
 
-    add_unary_terms(state, sol_result, term_results, term_lefts,
+    add_unary_terms(state, sol_result, term_results, term_lefts, pass_start,
             is_new, result, left);
 }
 
@@ -249,6 +252,7 @@ __global__ void pass_binary(
     uint32_t* __restrict__ term_results,
     uint32_t* __restrict__ term_lefts,
     uint32_t* __restrict__ term_rights,
+    uint32_t pass_start,
     uint32_t k,
     uint32_t n,
     uint32_t all_lefts_end,
@@ -361,7 +365,7 @@ __global__ void pass_binary(
         );
 
         compacted_write(
-            &term_lefts[bank_segment_start],
+            &term_lefts[bank_segment_start - pass_start],
             batch_buffer,
             batch_size,
             batch_idx,
@@ -370,7 +374,7 @@ __global__ void pass_binary(
         );
 
         compacted_write(
-            &term_rights[bank_segment_start],
+            &term_rights[bank_segment_start - pass_start],
             batch_buffer,
             batch_size,
             batch_idx,
@@ -380,13 +384,15 @@ __global__ void pass_binary(
     }
 }
 
-class Synthesizer : public AbstractSynthesizer {
+// The kernels work with 32-bit results regardless of the number of examples.
+class Synthesizer : public AbstractSynthesizer<uint32_t> {
 private:
     GPUBitset seen;
     SharedState* device_state;
 
 public:
-    Synthesizer(Spec spec) : AbstractSynthesizer(spec),
+    Synthesizer(Spec spec, const Options &options = Options()) :
+            AbstractSynthesizer<uint32_t>(spec, options),
             seen(GPUBitset_new(max_distinct_terms)) {
         SharedState state;
         gpuAssert(cudaMalloc(&device_state, sizeof(SharedState)));
@@ -399,6 +405,11 @@ public:
     }
 
 private:
+    // The kernels write operands as full bank indices.
+    bool narrow_operands() {
+        return false;
+    }
+
     SharedState sync_pass_state() {
         cudaDeviceSynchronize();
 
@@ -433,7 +444,8 @@ private:
             seen,
             spec.sol_result,
             term_results,
-            term_lefts,
+            pass_operands.back().wide_lefts(),
+            current_pass_start(),
             spec.num_vars,
             device_var_values,
             device_var_heights
@@ -459,7 +471,8 @@ private:
             seen,
             spec.sol_result,
             term_results,
-            term_lefts,
+            pass_operands.back().wide_lefts(),
+            current_pass_start(),
             all_lefts_start,
             all_lefts_end
         );
@@ -524,8 +537,9 @@ public:
                 self.seen,
                 self.spec.sol_result,
                 self.term_results,
-                self.term_lefts,
-                self.term_rights,
+                self.pass_operands.back().wide_lefts(),
+                self.pass_operands.back().wide_rights(),
+                self.current_pass_start(),
                 k,
                 n,
                 all_lefts_end,
@@ -562,8 +576,7 @@ public:
     // num_terms in device_state.
     int64_t insert_solution(uint32_t result, uint32_t left, uint32_t right) {
         term_results[num_terms] = result;
-        term_lefts[num_terms] = left;
-        term_rights[num_terms] = right;
+        store_operands(num_terms, left, right);
         return num_terms++;
     }
 
@@ -591,6 +604,26 @@ public:
 
         return NOT_FOUND;
     }
+
+    // The AND and OR checks run on the host. The bank is in managed memory,
+    // and no kernels are running between passes.
+    int64_t pass_AndCheck(int32_t height) {
+        uint32_t left, right;
+        if (!find_check_pair(height, 0, left, right)) {
+            return NOT_FOUND;
+        }
+
+        return insert_solution(spec.sol_result, left, right);
+    }
+
+    int64_t pass_OrCheck(int32_t height) {
+        uint32_t left, right;
+        if (!find_check_pair(height, result_mask, left, right)) {
+            return NOT_FOUND;
+        }
+
+        return insert_solution(spec.sol_result, left, right);
+    }
 };
 
 #endif
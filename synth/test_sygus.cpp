@@ -6,10 +6,16 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <filesystem>
 namespace fs = std::filesystem;
 
+#include "batch.hpp"
+#include "cegis.hpp"
 #include "expr.hpp"
+#include "options.hpp"
+#include "shannon.hpp"
 #include "spec.hpp"
 #include "parser.hpp"
 
@@ -28,73 +34,121 @@ namespace fs = std::filesystem;
 #error "Unsupported SYNTH_VARIANT."
 #endif
 
-int main(void) {
+// Solve spec, and write a report to out.
+BatchResult solve(Spec &spec, bool shannon, const Options &options, std::ostream &out) {
+    BatchResult result = {false, 0, "", ""};
+    out << spec << std::endl;
+
+    if (spec.num_vars > 8) {
+        out << "Skipping this one because it has too many (" << spec.num_vars << ") variables" << std::endl << std::endl;
+        return result;
+    }
+
+    out << "Number of variables: " << spec.num_vars << std::endl;
+
+    int32_t i;
+    const Expr* expr = shannon
+        ? shannon_cegis<Synthesizer>(spec, &out, i, options, &result.budget)
+        : cegis<Synthesizer>(spec, &out, i, options, &result.budget);
+    result.iterations = i;
+    if (expr == nullptr && result.budget.exceeded()) {
+        out << "no solution found in " << i << " iterations: ";
+        result.budget.print(out);
+        out << std::endl;
+    } else if (expr == nullptr) {
+        out << "no solution found in " << i << " iterations"<<std::endl;
+    } else {
+        std::ostringstream solution;
+        expr->print(solution, &spec.var_names);
+        result.solved = true;
+        result.solution = solution.str();
+
+        out << "solution found in " << i << " iterations: " << result.solution << std::endl;
+
+        const Expr* constant_height_solution = expr->with_constant_height(
+            spec.sol_height, spec.var_heights);
+
+        out << "constant height solution: ";
+        constant_height_solution->print(out, &spec.var_names);
+        out << std::endl;
+
+        spec.validate(constant_height_solution);
+    }
+
+    out << std::endl;
+    return result;
+}
+
+int main(int argc, char *argv[]) {
     std::cerr << "Synthesizer variant: " << VARIANT_DESCRIPTION << std::endl;
 
+    // With --shannon, split each spec into cofactors where possible. With
+    // --batch, solve specs concurrently (see batch.hpp), with BatchOptions
+    // such as --jobs=N. Other arguments are Options, e.g. --bank-dir=DIR or
+    // --cache-dir=DIR.
+    bool shannon = false;
+    bool batch = false;
+    Options options;
+    BatchOptions batch_options;
+    for (int arg = 1; arg < argc; arg++) {
+        if (std::string(argv[arg]) == "--shannon") {
+            shannon = true;
+        } else if (std::string(argv[arg]) == "--batch") {
+            batch = true;
+        } else if (!options.parse(argv[arg]) && !batch_options.parse(argv[arg])) {
+            std::cerr << "Unknown argument: " << argv[arg] << std::endl;
+            return 1;
+        }
+    }
+    // Both solve several specs at once, and shards can only be forked while no
+    // other thread is running (see synth_cpu_mt.hpp).
+    if (options.shards > 1 && (batch || shannon)) {
+        std::cerr << "--shards isn't supported with --batch or --shannon" << std::endl;
+        return 1;
+    }
+    set_alloc_policy(options.alloc_policy);
+
     ofstream outputFile;
     outputFile.open("synth_cpu_test.txt");
 
     std::string dir_path = "./inputs/";
-    std::string current_path;
+    std::vector<std::string> paths;
     for (const auto & entry : fs::directory_iterator(dir_path)) {
-        current_path = entry.path().string();
+        paths.push_back(entry.path().string());
+    }
 
+    if (batch) {
+        // Reports are written whole as specs finish, so that concurrent
+        // specs don't interleave.
+        BatchRunner runner(batch_options.jobs, [&](Spec &spec) {
+            std::ostringstream report;
+            BatchResult result = solve(spec, shannon, options, report);
+            result.report = report.str();
+            return result;
+        }, batch_options.results_path, outputFile);
+        runner.run(paths, [](const std::string &path) { return Parser::parseInput(path); });
+        outputFile.close();
+        return 0;
+    }
+
+    for (const std::string &current_path : paths) {
         outputFile << current_path << std::endl;
         std::cout << current_path << std::endl;
 
-        Spec spec = Parser::parseInput(current_path);
-        outputFile << spec << std::endl;
-
-        if (spec.num_vars > 8) {
-            outputFile << "Skipping this one because it has too many (" << spec.num_vars << ") variables" << std::endl << std::endl;
+        std::unique_ptr<Spec> spec;
+        try {
+            spec = std::make_unique<Spec>(Parser::parseInput(current_path));
+        } catch (const std::exception &e) {
+            outputFile << "Skipping this one because it can't be parsed: " << e.what()
+                << std::endl << std::endl;
             continue;
         }
 
-        outputFile << "Number of variables: " << spec.num_vars << std::endl;
-
-        const Expr* expr = nullptr;
-        // The i'th element specifies the values of the i'th variable,
-        // where the j'th bit of that integer is the variable's value in example j.
-        // used to update spec.var_values
-        std::vector<uint32_t> updated_var_vals(spec.num_vars);
-        // The i'th bit is the desired output in example i.
-        // used to update spec.sol_result
-        uint32_t updated_sol_result;
-        int i=0;
-        while(true) {
-            Synthesizer synthesizer(spec);
-            cout<<"synthesizing"<<std::endl;
-            //expr = synthesizer.synthesize(outputFile);
-            expr = synthesizer.synthesize();
-            cout<<"done synthesizing"<<std::endl;
-            if(expr==nullptr) break;
-            int counterExample = spec.advanceCEGISIteration(expr);
-            if(counterExample == -1) break;
-            outputFile << "Candidate (counterexample found "<<counterExample<<"): ";
-            expr->print(outputFile, &spec.var_names);
-            outputFile << std::endl;
-
-            cout<<"Iteration "<<i<<" "<<counterExample<<std::endl;
-            i++;
-        }
-        if (expr == nullptr) {
-            outputFile << "no solution found in " << i << " iterations"<<std::endl;
-        } else {
-            outputFile << "solution found in " << i << " iterations: ";
-            expr->print(outputFile, &spec.var_names);
-            outputFile << std::endl;
-
-            const Expr* constant_height_solution = expr->with_constant_height(
-                spec.sol_height, spec.var_heights);
-
-            outputFile << "constant height solution: ";
-            constant_height_solution->print(outputFile, &spec.var_names);
-            outputFile << std::endl;
-
-            spec.validate(constant_height_solution);
-        }
+        // Every expression for this spec is freed at the end of the iteration.
+        ExprArena arena;
+        ExprArena::Scope scope(arena);
 
-        outputFile << std::endl;
+        solve(*spec, shannon, options, outputFile);
     }
 
     outputFile.close();
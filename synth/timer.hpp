@@ -14,6 +14,11 @@ public:
         auto end = std::chrono::steady_clock::now();
         return std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
     }
+
+    uint64_t ns() {
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    }
 };
 
 #endif
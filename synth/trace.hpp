@@ -0,0 +1,129 @@
+// Timeline tracing of passes, tiles and threads, enabled with --trace=FILE.
+//
+// Each thread records events into its own ring buffer, so recording needs no
+// synchronization, and only the last TRACE_RING_EVENTS events of each thread
+// are kept. The buffers are written to FILE when the process exits, in the
+// Chrome trace format, which chrome://tracing and https://ui.perfetto.dev can
+// open. Shard processes (see synth_cpu_mt.hpp) exit without writing theirs,
+// so only the tiles of the first shard appear.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// Number of events kept per thread.
+#define TRACE_RING_EVENTS (1 << 16)
+
+// An event with a duration. name and arg_name must be string literals.
+struct TraceEvent {
+    const char* name;
+    const char* arg_name;
+    int64_t arg;
+    uint64_t begin_ns;
+    uint64_t end_ns;
+};
+
+class Tracer {
+private:
+    struct Ring {
+        int32_t thread;
+        uint64_t count = 0;
+        std::vector<TraceEvent> events;
+
+        Ring(int32_t thread) : thread(thread), events(TRACE_RING_EVENTS) {}
+    };
+
+    std::mutex mutex;
+    std::string path;
+    std::vector<std::unique_ptr<Ring>> rings;
+    const std::chrono::steady_clock::time_point origin;
+
+    Tracer() : origin(std::chrono::steady_clock::now()) {}
+
+    // The ring of the calling thread, which is created on first use. Rings
+    // outlive their threads, so that they can be written at exit.
+    Ring& ring() {
+        static thread_local Ring* local = nullptr;
+        if (local == nullptr) {
+            std::lock_guard<std::mutex> lock(mutex);
+            rings.push_back(std::make_unique<Ring>(rings.size()));
+            local = rings.back().get();
+        }
+        return *local;
+    }
+
+    void write() {
+        std::lock_guard<std::mutex> lock(mutex);
+        FILE* file = std::fopen(path.c_str(), "w");
+        if (file == nullptr) {
+            std::perror(path.c_str());
+            return;
+        }
+
+        int pid = getpid();
+        std::fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+        bool first = true;
+        for (const std::unique_ptr<Ring> &ring : rings) {
+            std::fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, "
+                    "\"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+                    first ? "" : ",\n", pid, ring->thread, ring->thread);
+            first = false;
+
+            uint64_t start = ring->count > TRACE_RING_EVENTS ? ring->count - TRACE_RING_EVENTS : 0;
+            for (uint64_t i = start; i < ring->count; i++) {
+                const TraceEvent &event = ring->events[i % TRACE_RING_EVENTS];
+                std::fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, "
+                        "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, "
+                        "\"args\": {\"%s\": %" PRId64 "}}",
+                        event.name, pid, ring->thread, event.begin_ns / 1000.0,
+                        (event.end_ns - event.begin_ns) / 1000.0, event.arg_name, event.arg);
+            }
+        }
+        std::fprintf(file, "\n]}\n");
+        std::fclose(file);
+    }
+
+public:
+    // Return the tracer, starting it if it isn't already, or nullptr if path
+    // is empty. The trace is written to the first path it was started with.
+    static Tracer* start(const std::string &trace_path) {
+        if (trace_path.empty()) {
+            return nullptr;
+        }
+
+        static Tracer tracer;
+        static std::once_flag started;
+        std::call_once(started, [&]() {
+            tracer.path = trace_path;
+            std::atexit([]() { tracer.write(); });
+        });
+        return &tracer;
+    }
+
+    // Nanoseconds since the tracer started.
+    uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - origin).count();
+    }
+
+    // Record an event on the calling thread that started at begin_ns and ends
+    // now.
+    void record(const char* name, const char* arg_name, int64_t arg, uint64_t begin_ns) {
+        Ring &local = ring();
+        local.events[local.count % TRACE_RING_EVENTS] = {name, arg_name, arg, begin_ns, now()};
+        local.count++;
+    }
+};
+
+#endif
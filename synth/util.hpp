@@ -1,7 +1,29 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <cstdint>
+
 // a divided by b, rounded up.
 #define CEIL_DIV(A, B) (((A) + (B) - 1) / (B))
 
+// The number of tiles in the trapezoid whose first column is k and whose
+// columns end at n, as covered by binary passes (see pass_binary in
+// synth_cpu_mt.hpp).
+inline int64_t trapezoid_num_tiles(int64_t k, int64_t n) {
+    return k * (n - k) + (n - k) * (n - k + 1) / 2;
+}
+
+// Map b, the 1D index of a tile of that trapezoid, to its row and column.
+// Tiles are numbered row by row across a rectangle with the same width and
+// area as the trapezoid, and the tiles of the rectangle that are outside the
+// trapezoid are moved inside it. See trapezoid_indexing.py.
+inline void trapezoid_tile(int64_t b, int64_t k, int64_t n, int64_t &row, int64_t &column) {
+    row = b / (n - k);
+    column = n - 1 - b % (n - k);
+    if (row > column) {
+        row = n - (row - (k + 1)) - 1;
+        column = n - (column - k) - 1;
+    }
+}
+
 #endif